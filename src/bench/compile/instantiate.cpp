@@ -0,0 +1,60 @@
+#include <array>
+#include <initializer_list>
+#include <ostream>
+#include <tuple>
+#include <utility>
+
+#include "prettyprint.h"
+
+// -----------------------------------------------------------------------------
+// Compile-time benchmark: push PRETTYPRINT_BENCH_TYPES distinct types through
+// six categories of the dispatch (outputtable, iterable, pair, tuple, enum,
+// callable; the tuple's last element is unprintable). Only the time taken to
+// compile this matters.
+#ifndef PRETTYPRINT_BENCH_TYPES
+#define PRETTYPRINT_BENCH_TYPES 500
+#endif
+
+template <int N>
+struct value { int v; };
+
+template <int N>
+std::ostream& operator<<(std::ostream& s, const value<N>& v)
+{
+  return s << v.v;
+}
+
+template <int N>
+struct enumeration { enum class type { A, B }; };
+
+template <int N>
+struct empty {};
+
+template <int N>
+struct function_object { void operator()() const {} };
+
+template <int N>
+void instantiate(counting_sink& s)
+{
+  prettyprint_to(s, value<N>{N});
+  prettyprint_to(s, std::array<value<N>, 2>{});
+  prettyprint_to(s, std::make_pair(N, value<N>{N}));
+  prettyprint_to(s, std::make_tuple(value<N>{N}, N, empty<N>{}));
+  prettyprint_to(s, enumeration<N>::type::B);
+  prettyprint_to(s, function_object<N>{});
+}
+
+template <int... Ns>
+std::size_t instantiate_all(std::integer_sequence<int, Ns...>)
+{
+  counting_sink s;
+  using I = std::initializer_list<int>;
+  (void) I { (instantiate<Ns>(s), 0)... };
+  return s.size();
+}
+
+std::size_t instantiate_all()
+{
+  return instantiate_all(
+      std::make_integer_sequence<int, PRETTYPRINT_BENCH_TYPES>());
+}
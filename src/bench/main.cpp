@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+using namespace std;
+
+#include "prettyprint.h"
+
+#if __cplusplus > 201703L && defined(__has_include)
+#if __has_include(<format>)
+#include <format>
+#endif
+#endif
+
+// -----------------------------------------------------------------------------
+// Formatting throughput benchmarks. Each case is run repeatedly for a short
+// while and the best time is reported, per element and as output bytes per
+// second. Each prettyprint case is compared against a hand-written loop
+// producing the same output (and std::format, where available).
+
+struct deque_formatter : public default_formatter
+{
+  template <typename T>
+  constexpr const char* opener(const deque<T>&) const
+  { return ">"; }
+
+  template <typename T>
+  constexpr const char* closer(const deque<T>&) const
+  { return ">"; }
+};
+
+struct hex_formatter : public default_formatter
+{
+  constexpr byte_format bytes_as() const { return byte_format::hex; }
+};
+
+struct parallel_formatter : public default_formatter
+{
+  size_t max_threads() const { return thread::hardware_concurrency(); }
+};
+
+// f returns the number of bytes it produced
+template <typename F>
+void bench(const char* name, size_t elements, F&& f)
+{
+  using clock = chrono::steady_clock;
+  const auto until = clock::now() + chrono::milliseconds(250);
+  auto best = clock::duration::max();
+  size_t bytes = 0;
+  int runs = 0;
+  do
+  {
+    const auto start = clock::now();
+    bytes = f();
+    best = min(best, clock::now() - start);
+    ++runs;
+  } while (runs < 3 || clock::now() < until);
+
+  const double ns = static_cast<double>(
+      chrono::duration_cast<chrono::nanoseconds>(best).count());
+  printf("%-44s %10.2f ns/elem %10.1f MB/s\n", name,
+         ns / static_cast<double>(elements),
+         static_cast<double>(bytes) * 1e3 / ns);
+}
+
+// the usual way of getting prettyprint output as a string
+template <typename T, typename... F>
+size_t via_ostringstream(const T& t, const F&... f)
+{
+  ostringstream oss;
+  oss << prettyprint(t, f...);
+  return oss.str().size();
+}
+
+template <typename T, typename... F>
+size_t via_to_string(const T& t, const F&... f)
+{
+  return prettyprint_to_string(t, f...).size();
+}
+
+void bench_vector_int()
+{
+  vector<int> v(1000000);
+  for (size_t i = 0; i < v.size(); ++i)
+    v[i] = static_cast<int>(i * 7919 % 2000003) - 1000000;
+
+  bench("vector<int> 1e6: ostream <<", v.size(),
+        [&] { return via_ostringstream(v); });
+  bench("vector<int> 1e6: prettyprint_to_string", v.size(),
+        [&] { return via_to_string(v); });
+  bench("vector<int> 1e6: to_string, all threads", v.size(),
+        [&] { return via_to_string(v, parallel_formatter()); });
+  bench("vector<int> 1e6: hand-rolled ostream", v.size(), [&] {
+      ostringstream oss;
+      oss << '[';
+      for (size_t i = 0; i < v.size(); ++i)
+        oss << (i ? "," : "") << v[i];
+      oss << ']';
+      return oss.str().size();
+    });
+  bench("vector<int> 1e6: hand-rolled to_string", v.size(), [&] {
+      string s = "[";
+      for (size_t i = 0; i < v.size(); ++i)
+      {
+        if (i)
+          s += ',';
+        s += to_string(v[i]);
+      }
+      s += ']';
+      return s.size();
+    });
+#ifdef __cpp_lib_format
+  bench("vector<int> 1e6: std::format", v.size(), [&] {
+      string s = "[";
+      for (size_t i = 0; i < v.size(); ++i)
+        format_to(back_inserter(s), i ? ",{}" : "{}", v[i]);
+      s += ']';
+      return s.size();
+    });
+#endif
+}
+
+void bench_vector_bool()
+{
+  vector<bool> v(1000000);
+  for (size_t i = 0; i < v.size(); ++i)
+    v[i] = i * 7919 % 3 == 0;
+
+  bench("vector<bool> 1e6: prettyprint_to_string", v.size(),
+        [&] { return via_to_string(v); });
+  bench("vector<bool> 1e6: hand-rolled string", v.size(), [&] {
+      string s = "[";
+      for (size_t i = 0; i < v.size(); ++i)
+      {
+        if (i)
+          s += ',';
+        s += v[i] ? "true" : "false";
+      }
+      s += ']';
+      return s.size();
+    });
+}
+
+void bench_vector_bytes()
+{
+  vector<uint8_t> v(1000000);
+  for (size_t i = 0; i < v.size(); ++i)
+    v[i] = static_cast<uint8_t>(i * 7919);
+
+  bench("vector<uint8_t> 1e6: hex", v.size(),
+        [&] { return via_to_string(v, hex_formatter()); });
+  bench("vector<uint8_t> 1e6: hand-rolled hex", v.size(), [&] {
+      static const char digits[] = "0123456789abcdef";
+      string s = "\"";
+      for (uint8_t b : v)
+      {
+        s += digits[b >> 4];
+        s += digits[b & 0xf];
+      }
+      s += '"';
+      return s.size();
+    });
+}
+
+void bench_vector_string()
+{
+  vector<string> v(100000);
+  for (size_t i = 0; i < v.size(); ++i)
+    v[i] = "string number " + to_string(i) + " in the vector";
+
+  bench("vector<string> 1e5: ostream <<", v.size(),
+        [&] { return via_ostringstream(v); });
+  bench("vector<string> 1e5: prettyprint_to_string", v.size(),
+        [&] { return via_to_string(v); });
+  bench("vector<string> 1e5: hand-rolled string", v.size(), [&] {
+      string s = "[";
+      for (size_t i = 0; i < v.size(); ++i)
+      {
+        if (i)
+          s += ',';
+        s += '"';
+        s += v[i];
+        s += '"';
+      }
+      s += ']';
+      return s.size();
+    });
+}
+
+void bench_wide_string()
+{
+  // mostly ASCII, with a non-ASCII character every hundred
+  u16string w(1000000, u'w');
+  for (size_t i = 0; i < w.size(); i += 100)
+    w[i] = u'\u00e9';
+
+  bench("u16string 1e6: prettyprint_to_string", w.size(),
+        [&] { return via_to_string(w); });
+  bench("u16string 1e6: hand-rolled UTF-8", w.size(), [&] {
+      string s = "\"";
+      for (char16_t c : w)
+      {
+        if (c < 0x80)
+          s += static_cast<char>(c);
+        else
+        {
+          s += static_cast<char>(0xc0 | (c >> 6));
+          s += static_cast<char>(0x80 | (c & 0x3f));
+        }
+      }
+      s += '"';
+      return s.size();
+    });
+}
+
+void bench_nested_map()
+{
+  map<string, vector<pair<int, double>>> m;
+  for (int i = 0; i < 1000; ++i)
+  {
+    auto& v = m["key" + to_string(i)];
+    for (int j = 0; j < 10; ++j)
+      v.emplace_back(i * j, i / (j + 1.0));
+  }
+  const size_t elements = 1000 * 10;
+
+  bench("map<string,vector<pair>> 1e4: ostream <<", elements,
+        [&] { return via_ostringstream(m); });
+  bench("map<string,vector<pair>> 1e4: to_string", elements,
+        [&] { return via_to_string(m); });
+  bench("map<string,vector<pair>> 1e4: JSON", elements,
+        [&] { return via_to_string(m, json_formatter()); });
+  bench("map<string,vector<pair>> 1e4: hand-rolled", elements, [&] {
+      ostringstream oss;
+      oss << '{';
+      bool first = true;
+      for (const auto& e : m)
+      {
+        oss << (first ? "(\"" : ",(\"") << e.first << "\",[";
+        first = false;
+        for (size_t i = 0; i < e.second.size(); ++i)
+          oss << (i ? ",(" : "(") << e.second[i].first << ','
+              << e.second[i].second << ')';
+        oss << "])";
+      }
+      oss << '}';
+      return oss.str().size();
+    });
+}
+
+void bench_diff()
+{
+  // one tick's worth of change in a large state map
+  map<int, vector<int>> before;
+  for (int i = 0; i < 10000; ++i)
+    before[i] = vector<int>(10, i);
+  map<int, vector<int>> after = before;
+  after[1234][5] = -1;
+  after.erase(5000);
+  const size_t elements = 10000 * 10;
+
+  bench("map<int,vector<int>> 1e5: to_string", elements,
+        [&] { return via_to_string(after); });
+  bench("map<int,vector<int>> 1e5: prettyprint_diff", elements,
+        [&] { return prettyprint_diff(before, after).size(); });
+}
+
+void bench_tuple()
+{
+  const auto t = make_tuple(1, 2.5, string("three"), 'c', 5u, -6l, 7.25f,
+                            "eight", true, 10ull);
+  const size_t n = 10000;
+
+  bench("tuple of 10 (x1e4): ostream <<", n * 10, [&] {
+      size_t bytes = 0;
+      for (size_t i = 0; i < n; ++i)
+        bytes += via_ostringstream(t);
+      return bytes;
+    });
+  bench("tuple of 10 (x1e4): prettyprint_to_string", n * 10, [&] {
+      size_t bytes = 0;
+      for (size_t i = 0; i < n; ++i)
+        bytes += via_to_string(t);
+      return bytes;
+    });
+  bench("tuple of 10 (x1e4): hand-rolled ostream", n * 10, [&] {
+      size_t bytes = 0;
+      for (size_t i = 0; i < n; ++i)
+      {
+        ostringstream oss;
+        oss << boolalpha << '(' << get<0>(t) << ',' << get<1>(t) << ",\""
+            << get<2>(t) << "\"," << get<3>(t) << ',' << get<4>(t) << ','
+            << get<5>(t) << ',' << get<6>(t) << ",\"" << get<7>(t) << "\","
+            << get<8>(t) << ',' << get<9>(t) << ')';
+        bytes += oss.str().size();
+      }
+      return bytes;
+    });
+#ifdef __cpp_lib_format
+  bench("tuple of 10 (x1e4): std::format", n * 10, [&] {
+      size_t bytes = 0;
+      for (size_t i = 0; i < n; ++i)
+        bytes += format("({},{},\"{}\",{},{},{},{},\"{}\",{},{})",
+                        get<0>(t), get<1>(t), get<2>(t), get<3>(t), get<4>(t),
+                        get<5>(t), get<6>(t), get<7>(t), get<8>(t),
+                        get<9>(t)).size();
+      return bytes;
+    });
+#endif
+}
+
+void bench_deque()
+{
+  deque<int> d;
+  for (int i = 0; i < 100000; ++i)
+    d.push_back(i);
+
+  bench("deque<int> 1e5, custom formatter: ostream <<", d.size(),
+        [&] { return via_ostringstream(d, deque_formatter()); });
+  bench("deque<int> 1e5, custom formatter: to_string", d.size(),
+        [&] { return via_to_string(d, deque_formatter()); });
+  bench("deque<int> 1e5: hand-rolled to_string", d.size(), [&] {
+      string s = ">";
+      for (size_t i = 0; i < d.size(); ++i)
+      {
+        if (i)
+          s += ',';
+        s += to_string(d[i]);
+      }
+      s += '>';
+      return s.size();
+    });
+}
+
+int main(int, char* [])
+{
+  bench_vector_int();
+  bench_vector_bool();
+  bench_vector_bytes();
+  bench_vector_string();
+  bench_wide_string();
+  bench_nested_map();
+  bench_diff();
+  bench_tuple();
+  bench_deque();
+  return 0;
+}
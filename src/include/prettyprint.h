@@ -2,16 +2,75 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <functional>
 #include <initializer_list>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <locale>
+#include <memory>
+#include <sstream>
+#include <streambuf>
 #include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
+#if !defined(PRETTYPRINT_NO_SIMD) && defined(__GNUC__)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PRETTYPRINT_AVX2 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PRETTYPRINT_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PRETTYPRINT_NEON 1
+#endif
+#endif
+
+#if !defined(PRETTYPRINT_NO_THREADS)
+#include <future>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define PRETTYPRINT_HAS_WRITEV 1
+#define PRETTYPRINT_HAS_MMAP 1
+#endif
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#define PRETTYPRINT_HAS_TO_CHARS 1
+#endif
+#if __has_include(<string_view>)
+#include <string_view>
+#define PRETTYPRINT_HAS_STRING_VIEW 1
+#endif
+#if __has_include(<optional>)
+#include <optional>
+#define PRETTYPRINT_HAS_OPTIONAL 1
+#endif
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define PRETTYPRINT_HAS_PMR 1
+#endif
+#endif
+
 // -----------------------------------------------------------------------------
 // A pretty-printer for (pretty much) any type.
 //
@@ -22,11 +81,43 @@
 // * Containers (iterable, with begin() and end()) get printed with customizable
 //   openers, closers and separators. The default is {}, with [] for vectors
 //   and arrays, and comma for a separator.
+//   Ranges ended by a sentinel and single-pass ranges (like views and
+//   generators) are walked once, with each element output as it's produced.
 // * Pairs are printed (like,this), as are tuples. This is also customizable in
 //   the same way as containers.
+// * Plain structs (aggregates) are printed {like,this}, field by field, as of
+//   C++17.
+// * Maps are printed as containers of pairs, but a formatter can give map
+//   entries their own opener, separator and closer (kv_opener etc.), like
+//   {key:value}.
 // * Strings and char arrays are printed with surrounding quotes. Again,
-//   customizable (if for example, you want single quotes).
-// * Enum values and enum class values are printed as integral values.
+//   customizable (if for example, you want single quotes). A formatter can
+//   also have their contents escaped, JSON-style, and invalid UTF-8 in them
+//   replaced.
+// * Wide strings and characters (wchar_t, char16_t and char32_t, taken as
+//   UTF-16 or UTF-32) are converted to UTF-8.
+// * Enum values and enum class values are printed as integral values, or with
+//   a formatter that asks for them, by name.
+// * Unordered containers can be printed in sorted order, for output that
+//   doesn't depend on hashing.
+// * A formatter can have pointers followed, with anything reached twice (or
+//   by a cycle) output once and referred to after that by id.
+// * A formatter with a line_width() gets multi-line, indented output for
+//   containers that don't fit on a line.
+// * Vectors and arrays of bytes can be output as hex, a hex dump or base64.
+// * With a json_formatter, output is JSON.
+// * With a cbor_formatter, output is binary (CBOR) rather than text.
+// * Large vectors and arrays can be formatted in chunks on several threads.
+// * Formatters can limit the number of elements printed per container, the
+//   nesting depth and the total size of the output. Past a limit, output is
+//   elided with "..." (and a count of what is left, if known).
+// * Integers and floating-point values are formatted directly (without going
+//   through the stream) as long as the stream has default flags and the
+//   classic locale - the output is the same either way.
+//   Vectors and arrays of integers, chars and bools (and vector<bool>) are
+//   written in bulk rather than element by element.
+// * A formatter can have each call report what it output (values, bytes,
+//   depth, and optionally time by kind of value), for metrics.
 // * Objects with operator() that can implicitly convert to bool are output as
 //   <callable> even though operator<< would work. An example is non-capturing
 //   lambdas, which can implicit convert to pointer-to-function and thus to
@@ -36,6 +127,27 @@
 // cout << prettyprint(x);
 // or:
 // cout << prettyprint(x, formatter);
+//
+// Output is assembled in a sink (see below) rather than being streamed token
+// by token. To format into a sink directly, do:
+// prettyprint_to(sink, x);
+// or:
+// prettyprint_to(sink, x, formatter);
+// And to get a string, do:
+// prettyprint_to_string(x[, formatter]);
+// or, with the string (and any memory used along the way) allocated by an
+// allocator or memory resource:
+// prettyprint_to_string(std::allocator_arg, allocator, x[, formatter]);
+// prettyprint_to_string(memory_resource, x[, formatter]);
+// or, to take the (thread-local) buffer used for formatting rather than a copy
+// of it:
+// prettyprint_to_buffer(x[, formatter]);
+// To output only what differs between two values of the same type (see
+// prettyprint_diff below), do:
+// prettyprint_diff(old, new[, formatter]);
+// To capture a value now and format it later (say, on a logging thread), do:
+// auto d = prettyprint_deferred(x[, formatter]);
+// and then cout << d, or d.str().
 
 // -----------------------------------------------------------------------------
 // SFINAE member/functionality detection
@@ -62,6 +174,12 @@ namespace detail
 
   struct is_iterable_tag {};
 
+  // Some ranges (views that cache, generators) can only be iterated when
+  // non-const.
+  template <typename T>
+  using needs_non_const = std::integral_constant<
+    bool, has_begin<T>::value && !has_begin<const T>::value>;
+
   // ---------------------------------------------------------------------------
   // Is the type a pair or tuple?
   template <typename T>
@@ -78,6 +196,27 @@ namespace detail
 
   struct is_tuple_tag {};
 
+  // ---------------------------------------------------------------------------
+  // Is the type an associative container of key-value pairs?
+  SFINAE_DETECT(mapped_type, std::declval<typename T::mapped_type*>())
+
+  template <typename T, bool = has_mapped_type<T>::value>
+  struct is_map_impl : public std::false_type {};
+  template <typename T>
+  struct is_map_impl<T, true>
+    : public std::integral_constant<
+        bool,
+        is_iterable<T>::value &&
+        is_pair<std::remove_cv_t<typename T::value_type>>::value> {};
+
+  template <typename T>
+  using is_map = is_map_impl<T>;
+
+  struct is_map_tag {};
+
+  // Is the container unordered (hashed)?
+  SFINAE_DETECT(hasher, std::declval<typename T::hasher*>())
+
   // ---------------------------------------------------------------------------
   // Is the type a callable of some kind?
   SFINAE_DETECT(call_operator, &T::operator())
@@ -121,7 +260,7 @@ namespace detail
 
   // ---------------------------------------------------------------------------
   // Does the type support operator<< ?
-  SFINAE_DETECT(operator_output, std::cout << std::declval<T>())
+  SFINAE_DETECT(operator_output, std::declval<std::ostream&>() << std::declval<T>())
 
   // Non-capturing lambdas (and some other callables) may implicitly convert to
   // bool, which will make operator<< work. We want to treat them as callables,
@@ -129,19 +268,123 @@ namespace detail
   bool bool_conversion_test(bool);
   SFINAE_DETECT(bool_conversion, bool_conversion_test(std::declval<T>()))
 
-  template<typename T>
-  using is_outputtable = typename std::conditional<
-    has_operator_output<T>::value &&
-    !std::is_function<T>::value &&
-    !(has_call_operator<T>::value && has_bool_conversion<T>::value),
-    std::true_type, std::false_type>::type;
+  // (the other checks are only made for types that have operator<<)
+  template <typename T, bool = has_operator_output<T>::value>
+  struct is_outputtable_impl : public std::false_type {};
+  template <typename T>
+  struct is_outputtable_impl<T, true>
+    : public std::integral_constant<
+        bool,
+        !std::is_function<T>::value &&
+        !std::conditional_t<has_call_operator<T>::value,
+                            has_bool_conversion<T>,
+                            std::false_type>::value> {};
+
+  template <typename T>
+  using is_outputtable = is_outputtable_impl<T>;
 
   struct is_outputtable_tag {};
 
+  // ---------------------------------------------------------------------------
+  // Is the type a wide character or string? Those are converted to UTF-8
+  // rather than streamed (a narrow stream has no operator<< for most of them).
+  template <typename T>
+  struct is_wide_char : public std::false_type {};
+  template <>
+  struct is_wide_char<wchar_t> : public std::true_type {};
+  template <>
+  struct is_wide_char<char16_t> : public std::true_type {};
+  template <>
+  struct is_wide_char<char32_t> : public std::true_type {};
+
+  template <typename T>
+  struct is_wide_string : public is_wide_char<T> {};
+  template <typename T>
+  struct is_wide_string<T*> : public is_wide_char<std::remove_cv_t<T>> {};
+  template <typename T, std::size_t N>
+  struct is_wide_string<T[N]> : public is_wide_char<std::remove_cv_t<T>> {};
+  template <typename C, typename Tr, typename A>
+  struct is_wide_string<std::basic_string<C, Tr, A>> : public is_wide_char<C> {};
+#ifdef PRETTYPRINT_HAS_STRING_VIEW
+  template <typename C, typename Tr>
+  struct is_wide_string<std::basic_string_view<C, Tr>> : public is_wide_char<C> {};
+#endif
+
+  struct is_wide_string_tag {};
+
   // ---------------------------------------------------------------------------
   // Is the type an enum or enum class?
   struct is_enum_tag {};
 
+  // ---------------------------------------------------------------------------
+  // Is the type an aggregate (a plain struct) that can be output field by
+  // field? That takes structured bindings, so C++17. The number of fields is
+  // the most values it can be brace-initialized from. That is counted twice,
+  // with values convertible to anything and with each such value in its own
+  // braces, and a struct only counts if both agree: bare values brace-elide
+  // into array fields (counting each element), and braced ones are ambiguous
+  // for some class types. Base classes (whose fields can't be bound) aren't
+  // detected, so an aggregate with a base must have its own operator<<.
+#if defined(__cpp_structured_bindings) && defined(__cpp_lib_is_aggregate)
+#define PRETTYPRINT_HAS_AGGREGATES 1
+  constexpr std::size_t max_aggregate_fields = 32;
+
+  // Only ever used unevaluated, so the conversion is never defined. It isn't
+  // constexpr either: that would make it inline, and some class types (like
+  // std::optional) still instantiate a use of it, which warns.
+  struct any_field
+  {
+    template <typename T>
+    operator T() const;
+  };
+
+  template <typename T, typename Is, typename = void>
+  struct brace_initializable : public std::false_type {};
+  template <typename T, std::size_t... Is>
+  struct brace_initializable<
+    T, std::index_sequence<Is...>,
+    std::void_t<decltype(T{(void(Is), any_field{})...})>>
+    : public std::true_type {};
+
+  template <typename T, typename Is, typename = void>
+  struct nested_brace_initializable : public std::false_type {};
+  template <typename T, std::size_t... Is>
+  struct nested_brace_initializable<
+    T, std::index_sequence<Is...>,
+    std::void_t<decltype(T{{(void(Is), any_field{})}...})>>
+    : public std::true_type {};
+
+  template <typename T, template <typename, typename, typename> class Init,
+            std::size_t N = max_aggregate_fields>
+  struct count_fields
+    : public std::conditional_t<
+        Init<T, std::make_index_sequence<N>, void>::value,
+        std::integral_constant<std::size_t, N>,
+        count_fields<T, Init, N - 1>> {};
+  template <typename T, template <typename, typename, typename> class Init>
+  struct count_fields<T, Init, 0>
+    : public std::integral_constant<std::size_t, 0> {};
+
+  template <typename T, bool = std::is_aggregate<T>::value
+                               && std::is_class<T>::value>
+  struct field_count : public std::integral_constant<std::size_t, 0> {};
+  template <typename T>
+  struct field_count<T, true>
+    : public std::integral_constant<
+        std::size_t,
+        count_fields<T, brace_initializable>::value
+        == count_fields<T, nested_brace_initializable>::value
+        ? count_fields<T, brace_initializable>::value : 0> {};
+
+  template <typename T>
+  using is_aggregate = std::integral_constant<bool, (field_count<T>::value > 0)>;
+#else
+  template <typename T>
+  using is_aggregate = std::false_type;
+#endif
+
+  struct is_aggregate_tag {};
+
   // ---------------------------------------------------------------------------
   // Is the type something unprintable?
   template<typename T>
@@ -166,481 +409,5434 @@ namespace detail
   std::enable_if_t<std::is_null_pointer<T>::value, const char*>
   unprintable_type() { return "<nullptr>"; }
 
-  // The way we want to treat a type, in preference order.
-  template <typename T>
-  using stringifier_tag = std::conditional_t<
-    std::is_enum<T>::value,
-    is_enum_tag,
-    std::conditional_t<
-      is_outputtable<T>::value,
-      is_outputtable_tag,
-      std::conditional_t<
-        is_callable<T>::value,
-        is_callable_tag,
-        std::conditional_t<
-          is_iterable<T>::value,
-          is_iterable_tag,
-          std::conditional_t<
-            is_pair<T>::value,
-            is_pair_tag,
-            std::conditional_t<
-              is_tuple<T>::value,
-              is_tuple_tag,
-              std::conditional_t<
-                is_unprintable<T>::value,
-                is_unprintable_tag,
-                void>>>>>>>;
+  // ---------------------------------------------------------------------------
+  // The way we want to treat a type, in preference order. Each step tests one
+  // trait, and only if that fails is the next step (and its trait)
+  // instantiated; nested std::conditional_t would instantiate every trait for
+  // every type.
+#define TAG_STEP(name, trait, tag, next)                                \
+  template <typename T, bool = trait<T>::value>                         \
+  struct name { using type = tag; };                                    \
+  template <typename T>                                                 \
+  struct name<T, false> : public next<T> {};
+
+  template <typename T>
+  struct no_tag { using type = void; };
+
+  TAG_STEP(unprintable_step, is_unprintable, is_unprintable_tag, no_tag)
+  TAG_STEP(aggregate_step, is_aggregate, is_aggregate_tag, unprintable_step)
+  TAG_STEP(tuple_step, is_tuple, is_tuple_tag, aggregate_step)
+  TAG_STEP(pair_step, is_pair, is_pair_tag, tuple_step)
+  TAG_STEP(iterable_step, is_iterable, is_iterable_tag, pair_step)
+  TAG_STEP(map_step, is_map, is_map_tag, iterable_step)
+  TAG_STEP(callable_step, is_callable, is_callable_tag, map_step)
+  TAG_STEP(outputtable_step, is_outputtable, is_outputtable_tag, callable_step)
+  // nullptr is checked before operator<< because (as of C++17) it has one
+  TAG_STEP(nullptr_step, std::is_null_pointer, is_unprintable_tag, outputtable_step)
+  TAG_STEP(enum_step, std::is_enum, is_enum_tag, nullptr_step)
+  TAG_STEP(wide_string_step, is_wide_string, is_wide_string_tag, enum_step)
+
+#undef TAG_STEP
+
+  template <typename T>
+  using stringifier_tag = typename wide_string_step<T>::type;
 
 } // detail
 
 // -----------------------------------------------------------------------------
-template <typename T, typename F, typename TAG>
-struct stringifier_select;
+// Sinks: where the output goes.
+//
+// Streaming every opener, separator, closer and element through operator<<
+// costs a sentry and a locale lookup per token, so the engine writes to a sink
+// instead. A sink is any type providing:
+//
+//   void write(const char* p, std::size_t n);
+//   void put(char c);
+//   std::ostream& stream();
+//
+// stream() is the fallback for values that can only be output with
+// operator<<; anything written to it must appear in order with everything
+// else written to the sink.
+//
+// A sink may also provide:
+//
+//   bool default_format() const;
+//
+// returning false when its stream has non-default flags or locale, in which
+// case numbers are output through stream() rather than formatted directly, and:
+//
+//   std::size_t size() const;
+//
+// returning the number of bytes written so far, which is needed for a
+// formatter's max_bytes() limit to take effect, and:
+//
+//   void write_ref(const char* p, std::size_t n);
+//
+// which is used instead of write() for string contents, which belong to the
+// value being output rather than being formatted on the fly. The sink may
+// keep a reference to the characters instead of copying them until:
+//
+//   void end_output();
+//
+// which is called at the end of each prettyprint_to (or operator<<), before
+// the value can go away.
+namespace detail
+{
+  // A streambuf that forwards to a sink, used to give buffer-backed sinks a
+  // stream() when they need one.
+  template <typename S>
+  class sink_streambuf : public std::streambuf
+  {
+  public:
+    explicit sink_streambuf(S& s)
+      : m_s(s)
+    {}
 
-template <typename T, typename F>
-using stringifier = stringifier_select<T, F, detail::stringifier_tag<std::remove_cv_t<T>>>;
+  protected:
+    int_type overflow(int_type c) override
+    {
+      if (!traits_type::eq_int_type(c, traits_type::eof()))
+        m_s.put(traits_type::to_char_type(c));
+      return traits_type::not_eof(c);
+    }
 
-template <typename T, typename F>
-inline std::ostream& operator<<(std::ostream& s, const stringifier<T, F>& t)
-{
-  return t.output(s);
-}
+    std::streamsize xsputn(const char* p, std::streamsize n) override
+    {
+      m_s.write(p, static_cast<std::size_t>(n));
+      return n;
+    }
+
+  private:
+    S& m_s;
+  };
+
+  // Formatting into a sink is locale-independent, so its stream uses the
+  // classic locale.
+  template <typename S>
+  struct sink_ostream : private sink_streambuf<S>, public std::ostream
+  {
+    explicit sink_ostream(S& s)
+      : sink_streambuf<S>(s)
+      , std::ostream(static_cast<sink_streambuf<S>*>(this))
+    {
+      std::ostream::imbue(std::locale::classic());
+    }
+  };
+} // detail
 
 // -----------------------------------------------------------------------------
-// Customization points for printing containers, pairs, tuples, strings
-struct default_formatter
+// Scratch memory. The memory a call allocates along the way (for sorting, the
+// pointers it has followed, quoting, layout) comes from the heap, unless the
+// call is formatting a string with an allocator of its own (see
+// prettyprint_to_string below), in which case it comes from that allocator
+// too. Threads formatting chunks of a large container use the heap.
+namespace detail
 {
-  // default separator, opener and closer
-  template <typename T>
-  constexpr const char* separator(const T&) const
-  { return ","; }
+  class scratch_resource
+  {
+  public:
+    virtual void* allocate(std::size_t n) = 0;
+    virtual void deallocate(void* p, std::size_t n) = 0;
 
-  template <typename T>
-  constexpr const char* opener(const T&) const
-  { return "{"; }
+  protected:
+    ~scratch_resource() = default;
+  };
 
-  template <typename T>
-  constexpr const char* closer(const T&) const
-  { return "}"; }
+  inline scratch_resource*& current_scratch()
+  {
+    static thread_local scratch_resource* r = nullptr;
+    return r;
+  }
 
-  // use [] for vectors and arrays
-  template <typename T>
-  constexpr const char* opener(const std::vector<T>&) const
-  { return "["; }
+  // Allocations from an allocator of chars, in units aligned for anything.
+  template <typename A>
+  class allocator_resource final : public scratch_resource
+  {
+  public:
+    explicit allocator_resource(const A& a)
+      : m_a(a)
+    {}
 
-  template <typename T>
-  constexpr const char* closer(const std::vector<T>&) const
-  { return "]"; }
+    void* allocate(std::size_t n) override
+    {
+      return traits::allocate(m_a, units(n));
+    }
 
-  template <typename T, size_t N>
-  constexpr const char* opener(const std::array<T, N>&) const
-  { return "["; }
+    void deallocate(void* p, std::size_t n) override
+    {
+      traits::deallocate(m_a, static_cast<unit*>(p), units(n));
+    }
 
-  template <typename T, size_t N>
-  constexpr const char* closer(const std::array<T, N>&) const
-  { return "]"; }
+  private:
+    struct alignas(std::max_align_t) unit
+    {
+      unsigned char bytes[alignof(std::max_align_t)];
+    };
+    using unit_allocator =
+      typename std::allocator_traits<A>::template rebind_alloc<unit>;
+    using traits = std::allocator_traits<unit_allocator>;
 
-  template <typename T, size_t N>
-  constexpr const char* opener(const T(&)[N]) const
-  { return "["; }
+    static std::size_t units(std::size_t n)
+    {
+      return (n + sizeof(unit) - 1) / sizeof(unit);
+    }
 
-  template <typename T, size_t N>
-  constexpr const char* closer(const T(&)[N]) const
-  { return "]"; }
+    unit_allocator m_a;
+  };
 
-  // use () for pairs and tuples
-  template <typename T, typename U>
-  constexpr const char* opener(const std::pair<T, U>&) const
-  { return "("; }
+  // Use r for scratch memory until the end of the scope.
+  class scratch_scope
+  {
+  public:
+    explicit scratch_scope(scratch_resource* r)
+      : m_saved(current_scratch())
+    {
+      current_scratch() = r;
+    }
+    scratch_scope(const scratch_scope&) = delete;
+    scratch_scope& operator=(const scratch_scope&) = delete;
+    ~scratch_scope() { current_scratch() = m_saved; }
 
-  template <typename T, typename U>
-  constexpr const char* closer(const std::pair<T, U>&) const
-  { return ")"; }
+  private:
+    scratch_resource* m_saved;
+  };
 
-  template <typename... Ts>
-  constexpr const char* opener(const std::tuple<Ts...>&) const
-  { return "("; }
+  // An allocator for the current scratch memory: the resource in use when it
+  // is made, or the heap.
+  template <typename T>
+  class scratch_allocator
+  {
+  public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
 
-  template <typename... Ts>
-  constexpr const char* closer(const std::tuple<Ts...>&) const
-  { return ")"; }
+    scratch_allocator()
+      : m_r(current_scratch())
+    {}
 
-  // use double quotes for strings
-  constexpr const char* opener(const std::string&) const
-  { return "\""; }
+    template <typename U>
+    scratch_allocator(const scratch_allocator<U>& a)
+      : m_r(a.resource())
+    {}
 
-  constexpr const char* closer(const std::string&) const
-  { return "\""; }
+    T* allocate(std::size_t n)
+    {
+      const std::size_t bytes = n * sizeof(T);
+      return static_cast<T*>(m_r ? m_r->allocate(bytes)
+                                 : ::operator new(bytes));
+    }
 
-  constexpr const char* opener(const char* const) const
-  { return "\""; }
+    void deallocate(T* p, std::size_t n)
+    {
+      if (m_r)
+        m_r->deallocate(p, n * sizeof(T));
+      else
+        ::operator delete(p);
+    }
 
-  constexpr const char* closer(const char* const) const
-  { return "\""; }
-};
+    scratch_resource* resource() const { return m_r; }
 
-// -----------------------------------------------------------------------------
-// The function that drives it all
-template <typename T>
-inline stringifier<std::remove_reference_t<T>, default_formatter>
-prettyprint(T&& t)
-{
-  return stringifier<std::remove_reference_t<T>, default_formatter>(
-      std::forward<T>(t), default_formatter());
-}
+    template <typename U>
+    bool operator==(const scratch_allocator<U>& a) const
+    { return m_r == a.resource(); }
 
-template <typename T, typename F>
-inline stringifier<std::remove_reference_t<T>, F>
-prettyprint(T&& t, F&& f)
-{
-  return stringifier<std::remove_reference_t<T>, F>(
-      std::forward<T>(t), std::forward<F>(f));
-}
+    template <typename U>
+    bool operator!=(const scratch_allocator<U>& a) const
+    { return m_r != a.resource(); }
 
-// -----------------------------------------------------------------------------
-// Default: not stringifiable
-template <typename T, typename F, typename TAG>
-struct stringifier_select
+  private:
+    scratch_resource* m_r;
+  };
+
+  using scratch_string =
+    std::basic_string<char, std::char_traits<char>, scratch_allocator<char>>;
+} // detail
+
+// A contiguous, growable char buffer.
+class buffer_sink
 {
-  explicit stringifier_select(const T&, F) {}
+public:
+  buffer_sink() = default;
+  buffer_sink(const buffer_sink&) = delete;
+  buffer_sink& operator=(const buffer_sink&) = delete;
+
+  void write(const char* p, std::size_t n) { m_buf.append(p, n); }
+  void put(char c) { m_buf.push_back(c); }
 
-  std::ostream& output(std::ostream& s) const
+  std::ostream& stream()
   {
-    return s << "<unknown>";
+    // constructing a stream is expensive: only do it if we have to, and only
+    // once
+    if (!m_stream)
+      m_stream = std::make_unique<detail::sink_ostream<buffer_sink>>(*this);
+    return *m_stream;
   }
-};
 
-// -----------------------------------------------------------------------------
-// Specialization for outputtable
-template <typename T, typename F>
-struct stringifier_select<T, F, detail::is_outputtable_tag>
-{
-  explicit stringifier_select(const T& t, F)
-    : m_t(t) {}
+  bool default_format() const { return true; }
+
+  const char* data() const { return m_buf.data(); }
+  std::size_t size() const { return m_buf.size(); }
+  void reserve(std::size_t n) { m_buf.reserve(n); }
+  void clear() { m_buf.clear(); }
+  const std::string& str() const { return m_buf; }
 
-  std::ostream& output(std::ostream& s) const
+  std::size_t capacity() const { return m_buf.capacity(); }
+
+  // Hand over the contents, leaving the sink empty.
+  std::string release()
   {
-    return s << m_t;
+    std::string s;
+    s.swap(m_buf);
+    return s;
   }
 
-  const T& m_t;
+  // Take over a string's storage (if it has more than ours) for reuse.
+  void recycle(std::string&& s)
+  {
+    if (s.capacity() > m_buf.capacity())
+    {
+      s.clear();
+      m_buf.swap(s);
+    }
+  }
+
+  // Give back the storage if there is more than n bytes of it.
+  void shrink(std::size_t n)
+  {
+    if (m_buf.capacity() > n)
+    {
+      m_buf.clear();
+      m_buf.shrink_to_fit();
+    }
+  }
+
+private:
+  std::string m_buf;
+  std::unique_ptr<detail::sink_ostream<buffer_sink>> m_stream;
 };
 
-// -----------------------------------------------------------------------------
-// Specialize for string
-template <typename C, typename T, typename A, typename F>
-struct stringifier_select<std::basic_string<C,T,A>, F, detail::is_outputtable_tag>
+// A growable char buffer whose storage (and stream, if one is needed) come
+// from an allocator.
+template <typename A>
+class string_sink
 {
-  using S = std::basic_string<C,T,A>;
-  explicit stringifier_select(const S& t, const F& f)
-    : m_t(t)
-    , m_f(f)
+public:
+  using string_type = std::basic_string<char, std::char_traits<char>, A>;
+
+  explicit string_sink(const A& a = A())
+    : m_buf(a)
   {}
+  string_sink(const string_sink&) = delete;
+  string_sink& operator=(const string_sink&) = delete;
 
-  std::ostream& output(std::ostream& s) const
+  ~string_sink()
   {
-    return s << m_f.opener(m_t)
-             << m_t
-             << m_f.closer(m_t);
+    if (m_stream)
+    {
+      stream_allocator a(m_buf.get_allocator());
+      stream_traits::destroy(a, m_stream);
+      stream_traits::deallocate(a, m_stream, 1);
+    }
   }
 
-  const S& m_t;
-  const F& m_f;
-};
+  void write(const char* p, std::size_t n) { m_buf.append(p, n); }
+  void put(char c) { m_buf.push_back(c); }
 
-template <typename C, typename T, typename A, typename F>
-struct stringifier_select<const std::basic_string<C,T,A>, F, detail::is_outputtable_tag>
-  : public stringifier_select<std::basic_string<C,T,A>, F, detail::is_outputtable_tag>
-{
-  using S = std::basic_string<C,T,A>;
-  explicit stringifier_select(const S& t, const F& f)
-    : stringifier_select<std::basic_string<C,T,A>, F, detail::is_outputtable_tag>(t, f)
-  {}
+  std::ostream& stream()
+  {
+    if (!m_stream)
+    {
+      stream_allocator a(m_buf.get_allocator());
+      stream_type* p = stream_traits::allocate(a, 1);
+      try
+      {
+        stream_traits::construct(a, p, *this);
+      }
+      catch (...)
+      {
+        stream_traits::deallocate(a, p, 1);
+        throw;
+      }
+      m_stream = p;
+    }
+    return *m_stream;
+  }
+
+  bool default_format() const { return true; }
+
+  const char* data() const { return m_buf.data(); }
+  std::size_t size() const { return m_buf.size(); }
+  void reserve(std::size_t n) { m_buf.reserve(n); }
+  void clear() { m_buf.clear(); }
+  const string_type& str() const { return m_buf; }
+
+  // Hand over the contents, leaving the sink empty.
+  string_type release()
+  {
+    string_type s(m_buf.get_allocator());
+    s.swap(m_buf);
+    return s;
+  }
+
+private:
+  using stream_type = detail::sink_ostream<string_sink>;
+  using stream_allocator =
+    typename std::allocator_traits<A>::template rebind_alloc<stream_type>;
+  using stream_traits = std::allocator_traits<stream_allocator>;
+
+  string_type m_buf;
+  stream_type* m_stream = nullptr;
 };
 
-// -----------------------------------------------------------------------------
-// Specialize for char* pointer-to-const and const-pointer varieties
-template <typename F>
-struct stringifier_select<char*, F, detail::is_outputtable_tag>
+// A buffer that is written to a std::ostream in one go when it is flushed (or
+// destroyed). Very large outputs are flushed in chunks so that the buffer stays
+// bounded.
+class ostream_sink
 {
-  explicit stringifier_select(const char* const t, const F& f)
-    : m_t(t)
-    , m_f(f)
+public:
+  static constexpr std::size_t flush_threshold = 64 * 1024;
+
+  explicit ostream_sink(std::ostream& os)
+    : m_os(os)
+    , m_default_format(os.flags() == (std::ios_base::skipws | std::ios_base::dec)
+                       && os.precision() == 6
+                       && os.width() == 0
+                       && os.getloc() == std::locale::classic())
   {}
+  ostream_sink(const ostream_sink&) = delete;
+  ostream_sink& operator=(const ostream_sink&) = delete;
+  ~ostream_sink() { flush(); }
 
-  std::ostream& output(std::ostream& s) const
+  void write(const char* p, std::size_t n)
   {
-    return s << m_f.opener(m_t)
-             << m_t
-             << m_f.closer(m_t);
+    m_buf.write(p, n);
+    if (m_buf.size() >= flush_threshold)
+      flush();
   }
 
-  const char* const m_t;
-  const F& m_f;
+  // Bytes written through the sink (not counting anything written directly to
+  // stream()).
+  std::size_t size() const { return m_flushed + m_buf.size(); }
+
+  void put(char c) { m_buf.put(c); }
+
+  // Anything going directly to the stream must come after what is buffered.
+  std::ostream& stream()
+  {
+    flush();
+    return m_os;
+  }
+
+  bool default_format() const { return m_default_format; }
+
+  void flush()
+  {
+    if (m_buf.size() > 0)
+    {
+      m_os.write(m_buf.data(), static_cast<std::streamsize>(m_buf.size()));
+      m_flushed += m_buf.size();
+      m_buf.clear();
+    }
+  }
+
+private:
+  std::ostream& m_os;
+  bool m_default_format;
+  std::size_t m_flushed = 0;
+  buffer_sink m_buf;
 };
 
-template <typename F>
-struct stringifier_select<char* const, F, detail::is_outputtable_tag>
-  : public stringifier_select<char*, F, detail::is_outputtable_tag>
+// A sink that only counts what is written to it, for measuring output.
+class counting_sink
 {
-  explicit stringifier_select(char* const t, const F& f)
-    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
-  {}
+public:
+  counting_sink() = default;
+  counting_sink(const counting_sink&) = delete;
+  counting_sink& operator=(const counting_sink&) = delete;
+
+  void write(const char*, std::size_t n) { m_size += n; }
+  void put(char) { ++m_size; }
+
+  std::ostream& stream()
+  {
+    if (!m_stream)
+      m_stream = std::make_unique<detail::sink_ostream<counting_sink>>(*this);
+    return *m_stream;
+  }
+
+  bool default_format() const { return true; }
+  std::size_t size() const { return m_size; }
+
+private:
+  std::size_t m_size = 0;
+  std::unique_ptr<detail::sink_ostream<counting_sink>> m_stream;
 };
 
-template <typename F>
-struct stringifier_select<const char*, F, detail::is_outputtable_tag>
-  : public stringifier_select<char*, F, detail::is_outputtable_tag>
+#if defined(PRETTYPRINT_HAS_WRITEV)
+// A sink that writes to a file descriptor with writev. Large strings aren't
+// copied: the sink refers to them directly until the end of the call that
+// output them. Everything else is copied into a buffer that is written along
+// with them, when enough is pending or when the sink is flushed (or
+// destroyed).
+class writev_sink
 {
-  explicit stringifier_select(const char* t, const F& f)
-    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
+public:
+  // strings shorter than this are copied
+  static constexpr std::size_t ref_threshold = 256;
+  static constexpr std::size_t flush_threshold = 64 * 1024;
+  static constexpr std::size_t max_segments = IOV_MAX < 1024 ? IOV_MAX : 1024;
+
+  explicit writev_sink(int fd)
+    : m_fd(fd)
   {}
-};
+  writev_sink(const writev_sink&) = delete;
+  writev_sink& operator=(const writev_sink&) = delete;
+  ~writev_sink() { flush(); }
 
-template <typename F>
-struct stringifier_select<const char* const, F, detail::is_outputtable_tag>
-  : public stringifier_select<char*, F, detail::is_outputtable_tag>
+  void write(const char* p, std::size_t n)
+  {
+    if (n == 0)
+      return;
+    if (m_segments.empty() || m_segments.back().p)
+      m_segments.push_back({nullptr, 0});
+    m_segments.back().n += n;
+    m_buf.append(p, n);
+    m_pending += n;
+    if (m_buf.size() >= flush_threshold || m_segments.size() >= max_segments)
+      flush();
+  }
+
+  void put(char c) { write(&c, 1); }
+
+  void write_ref(const char* p, std::size_t n)
+  {
+    if (n < ref_threshold)
+      return write(p, n);
+    m_segments.push_back({p, n});
+    m_pending += n;
+    m_refs = true;
+    if (m_segments.size() >= max_segments)
+      flush();
+  }
+
+  std::ostream& stream()
+  {
+    if (!m_stream)
+      m_stream = std::make_unique<detail::sink_ostream<writev_sink>>(*this);
+    return *m_stream;
+  }
+
+  bool default_format() const { return true; }
+  std::size_t size() const { return m_written + m_pending; }
+
+  // referenced strings may go away after this
+  void end_output()
+  {
+    if (m_refs)
+      flush();
+  }
+
+  // Whether everything so far was written: on an error, the errno is kept
+  // and nothing more is written.
+  bool good() const { return m_error == 0; }
+  int error() const { return m_error; }
+
+  void flush()
+  {
+    std::vector<iovec> iov;
+    iov.reserve(m_segments.size());
+    const char* staged = m_buf.data();
+    for (const auto& seg : m_segments)
+    {
+      const char* p = seg.p ? seg.p : staged;
+      if (!seg.p)
+        staged += seg.n;
+      iov.push_back({const_cast<char*>(p), seg.n});
+    }
+
+    for (std::size_t i = 0; i < iov.size() && m_error == 0; )
+    {
+      const ssize_t r = ::writev(m_fd, &iov[i], static_cast<int>(iov.size() - i));
+      if (r < 0)
+      {
+        if (errno != EINTR)
+          m_error = errno;
+        continue;
+      }
+      // skip what was written, which may end part way through a segment
+      std::size_t n = static_cast<std::size_t>(r);
+      m_written += n;
+      while (i < iov.size() && n >= iov[i].iov_len)
+        n -= iov[i++].iov_len;
+      if (n > 0)
+      {
+        iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + n;
+        iov[i].iov_len -= n;
+      }
+    }
+
+    m_segments.clear();
+    m_buf.clear();
+    m_pending = 0;
+    m_refs = false;
+  }
+
+private:
+  // a run of the buffer when p is null, otherwise referenced characters
+  struct segment
+  {
+    const char* p;
+    std::size_t n;
+  };
+
+  int m_fd;
+  int m_error = 0;
+  std::size_t m_written = 0;
+  std::size_t m_pending = 0;
+  bool m_refs = false;
+  std::vector<segment> m_segments;
+  std::string m_buf;
+  std::unique_ptr<detail::sink_ostream<writev_sink>> m_stream;
+};
+#endif
+
+#if defined(PRETTYPRINT_HAS_MMAP)
+// A sink that writes straight into a file through a memory map. The file is
+// extended, and a window of it mapped, a chunk at a time; when the sink is
+// closed (or destroyed) the file is truncated to what was written.
+class mmap_sink
+{
+public:
+  static constexpr std::size_t default_chunk = 64 * 1024 * 1024;
+
+  // Create (or truncate) the file at path.
+  explicit mmap_sink(const char* path, std::size_t chunk = default_chunk)
+    : m_fd(::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666))
+    , m_owns_fd(true)
+    , m_chunk(page_multiple(chunk))
+  {
+    if (m_fd < 0)
+      m_error = errno;
+  }
+
+  // Write to an open file (from its start), which is left open on close.
+  explicit mmap_sink(int fd, std::size_t chunk = default_chunk)
+    : m_fd(fd)
+    , m_owns_fd(false)
+    , m_chunk(page_multiple(chunk))
+  {}
+
+  mmap_sink(const mmap_sink&) = delete;
+  mmap_sink& operator=(const mmap_sink&) = delete;
+  ~mmap_sink() { close(); }
+
+  void write(const char* p, std::size_t n)
+  {
+    while (n > 0)
+    {
+      if (m_pos == m_end && !next_window())
+        return;
+      const std::size_t k =
+        std::min(n, static_cast<std::size_t>(m_end - m_pos));
+      std::memcpy(m_pos, p, k);
+      m_pos += k;
+      p += k;
+      n -= k;
+    }
+  }
+
+  void put(char c)
+  {
+    if (m_pos != m_end)
+      *m_pos++ = c;
+    else
+      write(&c, 1);
+  }
+
+  std::ostream& stream()
+  {
+    if (!m_stream)
+      m_stream = std::make_unique<detail::sink_ostream<mmap_sink>>(*this);
+    return *m_stream;
+  }
+
+  bool default_format() const { return true; }
+  std::size_t size() const
+  { return m_offset + static_cast<std::size_t>(m_pos - m_window); }
+
+  // Whether everything so far was written: on an error, the errno is kept
+  // and nothing more is written.
+  bool good() const { return m_error == 0; }
+  int error() const { return m_error; }
+
+  void close()
+  {
+    if (m_fd < 0)
+      return;
+    unmap();
+    if (::ftruncate(m_fd, static_cast<off_t>(m_offset)) != 0 && m_error == 0)
+      m_error = errno;
+    if (m_owns_fd)
+      ::close(m_fd);
+    m_fd = -1;
+  }
+
+private:
+  static std::size_t page_multiple(std::size_t n)
+  {
+    const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    return n < page ? page : n / page * page;
+  }
+
+  void unmap()
+  {
+    if (m_window)
+    {
+      m_offset += static_cast<std::size_t>(m_pos - m_window);
+      ::munmap(m_window, m_chunk);
+    }
+    m_window = m_pos = m_end = nullptr;
+  }
+
+  // The current window is full (so the offset stays page-aligned): extend the
+  // file and map the next chunk of it.
+  bool next_window()
+  {
+    if (m_error != 0)
+      return false;
+    unmap();
+    const off_t offset = static_cast<off_t>(m_offset);
+    const off_t length = static_cast<off_t>(m_chunk);
+#if defined(__linux__)
+    int r = ::posix_fallocate(m_fd, offset, length);
+    if (r == EINVAL || r == EOPNOTSUPP)
+      r = ::ftruncate(m_fd, offset + length) == 0 ? 0 : errno;
+#else
+    int r = ::ftruncate(m_fd, offset + length) == 0 ? 0 : errno;
+#endif
+    if (r != 0)
+    {
+      m_error = r;
+      return false;
+    }
+
+    void* p = ::mmap(nullptr, m_chunk, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     m_fd, offset);
+    if (p == MAP_FAILED)
+    {
+      m_error = errno;
+      return false;
+    }
+    m_window = m_pos = static_cast<char*>(p);
+    m_end = m_window + m_chunk;
+    return true;
+  }
+
+  int m_fd;
+  bool m_owns_fd;
+  int m_error = 0;
+  std::size_t m_chunk;
+  std::size_t m_offset = 0;
+  char* m_window = nullptr;
+  char* m_pos = nullptr;
+  char* m_end = nullptr;
+  std::unique_ptr<detail::sink_ostream<mmap_sink>> m_stream;
+};
+#endif
+
+// -----------------------------------------------------------------------------
+// A string constant that knows its length, for formatters to return so that
+// openers, closers and separators don't need strlen. Formatters may also return
+// const char* (or std::string, or std::string_view).
+struct format_literal
+{
+  template <std::size_t N>
+  constexpr format_literal(const char (&s)[N])
+    : m_str(s)
+    , m_size(N - 1)
+  {}
+
+  constexpr format_literal(const char* s, std::size_t n)
+    : m_str(s)
+    , m_size(n)
+  {}
+
+  constexpr const char* data() const { return m_str; }
+  constexpr std::size_t size() const { return m_size; }
+  constexpr operator const char*() const { return m_str; }
+
+private:
+  const char* m_str;
+  std::size_t m_size;
+};
+
+namespace detail
+{
+  inline format_literal as_literal(const char* p)
+  {
+    return format_literal(p, std::strlen(p));
+  }
+
+  constexpr format_literal as_literal(format_literal l)
+  {
+    return l;
+  }
+
+  template <typename T, typename A>
+  inline format_literal as_literal(const std::basic_string<char, T, A>& str)
+  {
+    return format_literal(str.data(), str.size());
+  }
+
+#ifdef PRETTYPRINT_HAS_STRING_VIEW
+  constexpr format_literal as_literal(std::string_view sv)
+  {
+    return format_literal(sv.data(), sv.size());
+  }
+#endif
+
+  // Keep a formatter's string for repeated use: measure it if it is a pointer,
+  // and hold on to it if it is a std::string returned by value.
+  template <typename T>
+  constexpr format_literal hoist(const T& t)
+  {
+    return as_literal(t);
+  }
+
+  template <typename T, typename A>
+  inline std::basic_string<char, T, A> hoist(std::basic_string<char, T, A>&& str)
+  {
+    return std::move(str);
+  }
+
+  template <typename S>
+  inline void emit(S& s, format_literal l)
+  {
+    s.write(l.data(), l.size());
+  }
+
+  template <typename S>
+  inline void emit(S& s, const char* p)
+  {
+    emit(s, as_literal(p));
+  }
+
+  template <typename S, typename T, typename A>
+  inline void emit(S& s, const std::basic_string<char, T, A>& str)
+  {
+    emit(s, as_literal(str));
+  }
+
+#ifdef PRETTYPRINT_HAS_STRING_VIEW
+  template <typename S>
+  inline void emit(S& s, std::string_view sv)
+  {
+    emit(s, as_literal(sv));
+  }
+#endif
+
+  template <typename S>
+  inline void emit(S& s, char c)
+  {
+    s.put(c);
+  }
+
+  // String contents may be referred to rather than copied, if the sink can.
+  SFINAE_DETECT(write_ref, (std::declval<T&>().write_ref(nullptr, 0), 0))
+
+  template <typename S>
+  inline std::enable_if_t<has_write_ref<S>::value>
+  write_ref(S& s, const char* p, std::size_t n) { s.write_ref(p, n); }
+
+  template <typename S>
+  inline std::enable_if_t<!has_write_ref<S>::value>
+  write_ref(S& s, const char* p, std::size_t n) { s.write(p, n); }
+
+  // ---------------------------------------------------------------------------
+  // Direct formatting of numbers
+  SFINAE_DETECT(default_format, std::declval<const T&>().default_format())
+
+  template <typename S>
+  inline std::enable_if_t<has_default_format<S>::value, bool>
+  default_format(const S& s) { return s.default_format(); }
+
+  template <typename S>
+  inline std::enable_if_t<!has_default_format<S>::value, bool>
+  default_format(const S&) { return true; }
+
+  // Character types are output as characters, not numbers.
+  template <typename T>
+  using is_formatted_integer = typename std::conditional<
+    std::is_integral<T>::value
+    && !std::is_same<std::remove_cv_t<T>, bool>::value
+    && !std::is_same<std::remove_cv_t<T>, char>::value
+    && !std::is_same<std::remove_cv_t<T>, signed char>::value
+    && !std::is_same<std::remove_cv_t<T>, unsigned char>::value
+    && !std::is_same<std::remove_cv_t<T>, wchar_t>::value
+    && !std::is_same<std::remove_cv_t<T>, char16_t>::value
+    && !std::is_same<std::remove_cv_t<T>, char32_t>::value,
+    std::true_type, std::false_type>::type;
+
+  // enough room for any integer, with sign
+  template <typename T>
+  using integer_buffer = std::array<char, std::numeric_limits<T>::digits10 + 3>;
+
+  // Write the decimal digits of u so that they end at last, and return the
+  // start of them.
+  template <typename U>
+  inline char* format_decimal(char* last, U u)
+  {
+    static constexpr char digit_pairs[] =
+      "00010203040506070809"
+      "10111213141516171819"
+      "20212223242526272829"
+      "30313233343536373839"
+      "40414243444546474849"
+      "50515253545556575859"
+      "60616263646566676869"
+      "70717273747576777879"
+      "80818283848586878889"
+      "90919293949596979899";
+    while (u >= 100)
+    {
+      const auto i = static_cast<std::size_t>(u % 100) * 2;
+      u = static_cast<U>(u / 100);
+      *--last = digit_pairs[i + 1];
+      *--last = digit_pairs[i];
+    }
+    if (u >= 10)
+    {
+      const auto i = static_cast<std::size_t>(u) * 2;
+      *--last = digit_pairs[i + 1];
+      *--last = digit_pairs[i];
+    }
+    else
+    {
+      *--last = static_cast<char>('0' + u);
+    }
+    return last;
+  }
+
+  template <typename S, typename T>
+  inline void output_integer(S& s, T t)
+  {
+    integer_buffer<T> buf;
+#ifdef PRETTYPRINT_HAS_TO_CHARS
+    const auto r = std::to_chars(buf.data(), buf.data() + buf.size(), t);
+    s.write(buf.data(), static_cast<std::size_t>(r.ptr - buf.data()));
+#else
+    using U = std::make_unsigned_t<std::remove_cv_t<T>>;
+    char* last = buf.data() + buf.size();
+    char* first;
+    if (t < 0)
+    {
+      first = format_decimal(last, static_cast<U>(U(0) - static_cast<U>(t)));
+      *--first = '-';
+    }
+    else
+    {
+      first = format_decimal(last, static_cast<U>(t));
+    }
+    s.write(first, static_cast<std::size_t>(last - first));
+#endif
+  }
+
+  // The default stream format for floating-point values is %g with precision 6.
+  constexpr int default_precision = 6;
+  using float_buffer = std::array<char, 32>;
+
+  template <typename S, typename T>
+  inline void output_float(S& s, T t)
+  {
+    float_buffer buf;
+#if defined(PRETTYPRINT_HAS_TO_CHARS) && defined(__cpp_lib_to_chars)
+    const auto r = std::to_chars(buf.data(), buf.data() + buf.size(), t,
+                                 std::chars_format::general, default_precision);
+    s.write(buf.data(), static_cast<std::size_t>(r.ptr - buf.data()));
+#else
+    const int n = std::snprintf(buf.data(), buf.size(), "%.*g",
+                                default_precision, static_cast<double>(t));
+    s.write(buf.data(), static_cast<std::size_t>(n));
+#endif
+  }
+
+  template <typename S>
+  inline void output_float(S& s, long double t)
+  {
+    float_buffer buf;
+#if defined(PRETTYPRINT_HAS_TO_CHARS) && defined(__cpp_lib_to_chars)
+    const auto r = std::to_chars(buf.data(), buf.data() + buf.size(), t,
+                                 std::chars_format::general, default_precision);
+    s.write(buf.data(), static_cast<std::size_t>(r.ptr - buf.data()));
+#else
+    const int n = std::snprintf(buf.data(), buf.size(), "%.*Lg",
+                                default_precision, t);
+    s.write(buf.data(), static_cast<std::size_t>(n));
+#endif
+  }
+
+  // Output a value that has operator<<, formatting it directly if we can.
+  template <typename S, typename T>
+  inline std::enable_if_t<is_formatted_integer<T>::value>
+  output_value(S& s, T t)
+  {
+    if (default_format(s))
+      output_integer(s, t);
+    else
+      s.stream() << t;
+  }
+
+  template <typename S, typename T>
+  inline std::enable_if_t<std::is_floating_point<T>::value>
+  output_value(S& s, T t)
+  {
+    if (default_format(s))
+      output_float(s, t);
+    else
+      s.stream() << t;
+  }
+
+  template <typename S, typename T>
+  inline std::enable_if_t<!is_formatted_integer<T>::value
+                          && !std::is_floating_point<T>::value>
+  output_value(S& s, const T& t)
+  {
+    s.stream() << t;
+  }
+
+  // ---------------------------------------------------------------------------
+  // JSON-style string escaping. Long strings mostly need no escaping, so we
+  // look for the next byte that does a vector at a time and copy everything
+  // before it in one go.
+  inline bool needs_escape(char c)
+  {
+    return static_cast<unsigned char>(c) < 0x20 || c == '"' || c == '\\';
+  }
+
+  inline const char* find_escape(const char* p, const char* end)
+  {
+#if defined(PRETTYPRINT_AVX2)
+    const __m256i ctrl = _mm256_set1_epi8(0x1f);
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    for (; end - p >= 32; p += 32)
+    {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      const __m256i m = _mm256_or_si256(
+          _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrl), v),
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                          _mm256_cmpeq_epi8(v, backslash)));
+      const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(m));
+      if (mask != 0)
+        return p + __builtin_ctz(mask);
+    }
+#elif defined(PRETTYPRINT_SSE2)
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    for (; end - p >= 16; p += 16)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const __m128i m = _mm_or_si128(
+          _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v),
+          _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                       _mm_cmpeq_epi8(v, backslash)));
+      const auto mask = static_cast<unsigned>(_mm_movemask_epi8(m));
+      if (mask != 0)
+        return p + __builtin_ctz(mask);
+    }
+#elif defined(PRETTYPRINT_NEON)
+    const uint8x16_t ctrl = vdupq_n_u8(0x1f);
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    for (; end - p >= 16; p += 16)
+    {
+      const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+      const uint8x16_t m = vorrq_u8(vcleq_u8(v, ctrl),
+                                    vorrq_u8(vceqq_u8(v, quote),
+                                             vceqq_u8(v, backslash)));
+      // find which byte within the block
+      if (vmaxvq_u8(m) != 0)
+        break;
+    }
+#endif
+    while (p != end && !needs_escape(*p))
+      ++p;
+    return p;
+  }
+
+  template <typename S>
+  inline void output_escape(S& s, char c)
+  {
+    static constexpr char hex_digits[] = "0123456789abcdef";
+    switch (c)
+    {
+      case '"': s.write("\\\"", 2); break;
+      case '\\': s.write("\\\\", 2); break;
+      case '\b': s.write("\\b", 2); break;
+      case '\f': s.write("\\f", 2); break;
+      case '\n': s.write("\\n", 2); break;
+      case '\r': s.write("\\r", 2); break;
+      case '\t': s.write("\\t", 2); break;
+      default:
+      {
+        const auto u = static_cast<unsigned char>(c);
+        const char buf[] = { '\\', 'u', '0', '0',
+                             hex_digits[u >> 4], hex_digits[u & 0xf] };
+        s.write(buf, sizeof(buf));
+        break;
+      }
+    }
+  }
+
+  template <typename S>
+  inline void output_escaped(S& s, const char* p, std::size_t n)
+  {
+    const char* end = p + n;
+    while (p != end)
+    {
+      const char* q = find_escape(p, end);
+      write_ref(s, p, static_cast<std::size_t>(q - p));
+      if (q == end)
+        break;
+      output_escape(s, *q);
+      p = q + 1;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+  // UTF-8. Validation skips ASCII a block at a time, and checks anything else
+  // a sequence at a time (rejecting overlong forms, surrogates and values past
+  // U+10FFFF).
+  constexpr char utf8_replacement[] = "\xef\xbf\xbd";  // U+FFFD
+
+  inline const char* skip_ascii(const char* p, const char* end)
+  {
+#if defined(PRETTYPRINT_AVX2)
+    for (; end - p >= 32; p += 32)
+    {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(v));
+      if (mask != 0)
+        return p + __builtin_ctz(mask);
+    }
+#elif defined(PRETTYPRINT_SSE2)
+    for (; end - p >= 16; p += 16)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const auto mask = static_cast<unsigned>(_mm_movemask_epi8(v));
+      if (mask != 0)
+        return p + __builtin_ctz(mask);
+    }
+#elif defined(PRETTYPRINT_NEON)
+    for (; end - p >= 16; p += 16)
+    {
+      const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+      if (vmaxvq_u8(v) >= 0x80)
+        break;
+    }
+#endif
+    while (p != end && static_cast<unsigned char>(*p) < 0x80)
+      ++p;
+    return p;
+  }
+
+  // The length of the sequence at p if it's valid, or minus the length of the
+  // longest start of a valid sequence there (at least 1), which is what is
+  // replaced.
+  inline std::ptrdiff_t utf8_sequence(const char* p, const char* end)
+  {
+    const auto c = static_cast<unsigned char>(*p);
+    unsigned lo = 0x80;
+    unsigned hi = 0xbf;
+    std::ptrdiff_t n;
+    if (c < 0x80)
+      return 1;
+    if (c >= 0xc2 && c <= 0xdf)
+      n = 2;
+    else if (c >= 0xe0 && c <= 0xef)
+    {
+      n = 3;
+      if (c == 0xe0)
+        lo = 0xa0;
+      else if (c == 0xed)
+        hi = 0x9f;
+    }
+    else if (c >= 0xf0 && c <= 0xf4)
+    {
+      n = 4;
+      if (c == 0xf0)
+        lo = 0x90;
+      else if (c == 0xf4)
+        hi = 0x8f;
+    }
+    else
+      return -1;
+
+    for (std::ptrdiff_t i = 1; i < n; ++i)
+    {
+      if (end - p == i)
+        return -i;
+      const auto u = static_cast<unsigned char>(p[i]);
+      if (u < lo || u > hi)
+        return -i;
+      lo = 0x80;
+      hi = 0xbf;
+    }
+    return n;
+  }
+
+  // Write the UTF-8 for a code point, and return its length.
+  inline std::size_t encode_utf8(char* out, std::uint32_t c)
+  {
+    if (c < 0x80)
+    {
+      out[0] = static_cast<char>(c);
+      return 1;
+    }
+    if (c < 0x800)
+    {
+      out[0] = static_cast<char>(0xc0 | (c >> 6));
+      out[1] = static_cast<char>(0x80 | (c & 0x3f));
+      return 2;
+    }
+    if (c < 0x10000)
+    {
+      out[0] = static_cast<char>(0xe0 | (c >> 12));
+      out[1] = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+      out[2] = static_cast<char>(0x80 | (c & 0x3f));
+      return 3;
+    }
+    out[0] = static_cast<char>(0xf0 | (c >> 18));
+    out[1] = static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+    out[2] = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+    out[3] = static_cast<char>(0x80 | (c & 0x3f));
+    return 4;
+  }
+
+  // Decode the code point at p, from UTF-16 (for 2-byte units) or UTF-32, and
+  // move p past it. Unpaired surrogates and values past U+10FFFF are U+FFFD.
+  template <typename C>
+  inline std::uint32_t decode_wide(const C*& p, const C* end)
+  {
+    const auto u = static_cast<std::uint32_t>(*p++);
+    if (sizeof(C) == 2 && u >= 0xd800 && u < 0xdc00 && p != end)
+    {
+      const auto v = static_cast<std::uint32_t>(*p);
+      if (v >= 0xdc00 && v < 0xe000)
+      {
+        ++p;
+        return 0x10000 + ((u - 0xd800) << 10) + (v - 0xdc00);
+      }
+    }
+    if ((u >= 0xd800 && u < 0xe000) || u > 0x10ffff)
+      return 0xfffd;
+    return u;
+  }
+
+  // Narrow the ASCII at the start of p (at most n units) into out, and return
+  // how many units that was. Whole blocks are checked and packed at once.
+  template <typename C>
+  inline void narrow_ascii_blocks(char*, const C*, std::size_t, std::size_t&,
+                                  long)
+  {}
+
+#if defined(PRETTYPRINT_AVX2) || defined(PRETTYPRINT_SSE2)
+  template <typename C>
+  inline std::enable_if_t<sizeof(C) == 2>
+  narrow_ascii_blocks(char* out, const C* p, std::size_t n, std::size_t& i, int)
+  {
+    const __m128i high = _mm_set1_epi16(static_cast<short>(0xff80));
+    for (; n - i >= 16; i += 16)
+    {
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 8));
+      const __m128i m = _mm_and_si128(_mm_or_si128(a, b), high);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(m, _mm_setzero_si128())) != 0xffff)
+        break;
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(a, b));
+    }
+  }
+
+  template <typename C>
+  inline std::enable_if_t<sizeof(C) == 4>
+  narrow_ascii_blocks(char* out, const C* p, std::size_t n, std::size_t& i, int)
+  {
+    const __m128i high = _mm_set1_epi32(static_cast<int>(0xffffff80));
+    for (; n - i >= 16; i += 16)
+    {
+      const auto q = reinterpret_cast<const __m128i*>(p + i);
+      const __m128i a = _mm_loadu_si128(q);
+      const __m128i b = _mm_loadu_si128(q + 1);
+      const __m128i c = _mm_loadu_si128(q + 2);
+      const __m128i d = _mm_loadu_si128(q + 3);
+      const __m128i m = _mm_and_si128(
+          _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), high);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi32(m, _mm_setzero_si128())) != 0xffff)
+        break;
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                       _mm_packus_epi16(_mm_packs_epi32(a, b),
+                                        _mm_packs_epi32(c, d)));
+    }
+  }
+#elif defined(PRETTYPRINT_NEON)
+  template <typename C>
+  inline std::enable_if_t<sizeof(C) == 2>
+  narrow_ascii_blocks(char* out, const C* p, std::size_t n, std::size_t& i, int)
+  {
+    for (; n - i >= 16; i += 16)
+    {
+      const auto q = reinterpret_cast<const uint16_t*>(p + i);
+      const uint16x8_t a = vld1q_u16(q);
+      const uint16x8_t b = vld1q_u16(q + 8);
+      if (vmaxvq_u16(vorrq_u16(a, b)) >= 0x80)
+        break;
+      vst1q_u8(reinterpret_cast<uint8_t*>(out + i),
+               vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+    }
+  }
+
+  template <typename C>
+  inline std::enable_if_t<sizeof(C) == 4>
+  narrow_ascii_blocks(char* out, const C* p, std::size_t n, std::size_t& i, int)
+  {
+    for (; n - i >= 16; i += 16)
+    {
+      const auto q = reinterpret_cast<const uint32_t*>(p + i);
+      const uint32x4_t a = vld1q_u32(q);
+      const uint32x4_t b = vld1q_u32(q + 4);
+      const uint32x4_t c = vld1q_u32(q + 8);
+      const uint32x4_t d = vld1q_u32(q + 12);
+      if (vmaxvq_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d))) >= 0x80)
+        break;
+      const uint16x8_t lo = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+      const uint16x8_t hi = vcombine_u16(vmovn_u32(c), vmovn_u32(d));
+      vst1q_u8(reinterpret_cast<uint8_t*>(out + i),
+               vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+    }
+  }
+#endif
+
+  template <typename C>
+  inline std::size_t narrow_ascii(char* out, const C* p, std::size_t n)
+  {
+    std::size_t i = 0;
+    narrow_ascii_blocks(out, p, n, i, 0);
+    for (; i < n && static_cast<std::uint32_t>(p[i]) < 0x80; ++i)
+      out[i] = static_cast<char>(p[i]);
+    return i;
+  }
+} // detail
+
+// -----------------------------------------------------------------------------
+template <typename T, typename F, typename TAG>
+struct stringifier_select;
+
+struct cbor_formatter;
+
+namespace detail
+{
+  // Formatters derived from cbor_formatter encode rather than format, using
+  // the same classification of types.
+  struct is_cbor_tag {};
+
+  // Types are classified without their cv-qualifiers, except that a const
+  // range that can only be iterated when non-const isn't a range.
+  template <typename T, typename Tag = stringifier_tag<std::remove_cv_t<T>>>
+  struct iterable_constness { using type = Tag; };
+  template <typename T>
+  struct iterable_constness<const T, is_iterable_tag>
+  {
+    using type = std::conditional_t<needs_non_const<T>::value,
+                                    is_unprintable_tag, is_iterable_tag>;
+  };
+
+  template <typename T, typename F,
+            bool = std::is_base_of<cbor_formatter, F>::value>
+  struct formatter_tag { using type = typename iterable_constness<T>::type; };
+  template <typename T, typename F>
+  struct formatter_tag<T, F, true> { using type = is_cbor_tag; };
+} // detail
+
+template <typename T, typename F>
+using stringifier = stringifier_select<
+  T, F, typename detail::formatter_tag<T, F>::type>;
+
+// -----------------------------------------------------------------------------
+// How vectors and arrays of bytes (unsigned char, or std::byte) are output,
+// according to a formatter's bytes_as().
+enum class byte_format
+{
+  elements,  // like any other container
+  hex,       // as a string of hex digits, like "0a1bff"
+  hexdump,   // as lines of offset, hex and printable characters (hexdump -C)
+  base64     // as a base64 (RFC 4648) string
+};
+
+// -----------------------------------------------------------------------------
+// Instrumentation. A formatter that has
+//
+//   void report_stats(const prettyprint_stats&) const;
+//
+// has it called at the end of each top-level call (operator<< or
+// prettyprint_to) with what the call did. With time_stats() as well, the time
+// spent is broken down by the kind of value output (excluding the values
+// nested in it), which costs a clock read before and after each value.
+// Formatters without report_stats() pay nothing.
+enum class stats_category
+{
+  outputtable,
+  enumeration,
+  callable,
+  map,
+  iterable,
+  pair,
+  tuple,
+  aggregate,
+  unprintable,
+  cbor
+};
+
+struct prettyprint_stats
+{
+  static constexpr std::size_t categories = 10;
+
+  // values output inside containers, pairs, tuples and structs
+  std::size_t elements = 0;
+  // bytes output, and the deepest nesting reached
+  std::size_t bytes = 0;
+  std::size_t max_depth = 0;
+  std::array<std::chrono::nanoseconds, categories> times{};
+
+  std::chrono::nanoseconds time(stats_category c) const
+  { return times[static_cast<std::size_t>(c)]; }
+};
+
+// -----------------------------------------------------------------------------
+// The values probed for names, for formatters that output enums by name (see
+// enum_names() below). Specialize this for an enum with values outside it;
+// a narrower range is also cheaper to compile. An unscoped enum without a
+// fixed underlying type must have it specialized: casting a value outside its
+// enumerators' range to it isn't defined, so the default can't be probed.
+template <typename E>
+struct enum_range
+{
+  static constexpr int min = -128;
+  static constexpr int max = 127;
+  static constexpr bool is_default = true;
+};
+
+// -----------------------------------------------------------------------------
+// Customization points for printing containers, pairs, tuples, strings
+struct default_formatter
+{
+  // default separator, opener and closer
+  template <typename T>
+  constexpr format_literal separator(const T&) const
+  { return ","; }
+
+  // limits on output: past these, the rest of a container is elided
+  constexpr std::size_t max_elements() const
+  { return std::numeric_limits<std::size_t>::max(); }
+
+  constexpr std::size_t max_depth() const
+  { return std::numeric_limits<std::size_t>::max(); }
+
+  constexpr std::size_t max_bytes() const
+  { return std::numeric_limits<std::size_t>::max(); }
+
+  // whether to escape quotes, backslashes and control characters in strings
+  constexpr bool escape_strings() const
+  { return false; }
+
+  // whether invalid UTF-8 in strings is replaced (each maximal invalid
+  // sequence by U+FFFD), so that strings are always output as valid UTF-8
+  constexpr bool validate_utf8() const
+  { return false; }
+
+  // whether to output unordered containers in sorted order (by key and then
+  // value, for maps), so that output doesn't depend on hashing (keys without
+  // operator< are left in hash order, as are the entries of a multimap with
+  // equal keys when values have no operator<)
+  constexpr bool sort_unordered() const
+  { return false; }
+
+  // how many threads may be used to output a large vector or array (each
+  // element is formatted independently, so elements' operator<< must be safe
+  // to call concurrently)
+  constexpr std::size_t max_threads() const
+  { return 1; }
+
+  // whether characters, and values output with operator<< that aren't
+  // numbers, are output as strings (with the string opener and closer, and
+  // escaped if strings are)
+  constexpr bool quote_values() const
+  { return false; }
+
+  // whether map keys are always output as strings (as JSON needs): keys that
+  // aren't output as strings anyway are quoted if they are numbers (or the
+  // like), and output as a string of their output if they are containers,
+  // pairs, tuples or structs
+  constexpr bool quote_keys() const
+  { return false; }
+
+  // what nullptr is output as
+  constexpr format_literal null_literal() const
+  { return "<nullptr>"; }
+
+  // whether infinities and NaNs are output as null_literal()
+  constexpr bool nonfinite_as_null() const
+  { return false; }
+
+  // whether pointers (raw and smart) and optionals are output as what they
+  // point to, with ids so that anything reached more than once (including by
+  // a cycle) is output just once: the first time as #id=value, after that as
+  // #id
+  constexpr bool follow_pointers() const
+  { return false; }
+
+  // whether prettyprint_stats has times, for formatters with report_stats()
+  // (see above)
+  constexpr bool time_stats() const
+  { return false; }
+
+  // indentation per level, for formatters with a line_width() (see below)
+  constexpr std::size_t indent_width() const
+  { return 2; }
+
+  // how vectors and arrays of bytes are output
+  constexpr byte_format bytes_as() const
+  { return byte_format::elements; }
+
+  // whether enum values are output by name (those with no name, or outside
+  // enum_range, are still output as integral values). This must be constexpr:
+  // it decides what code is generated.
+  constexpr bool enum_names() const
+  { return false; }
+
+  template <typename T>
+  constexpr format_literal opener(const T&) const
+  { return "{"; }
+
+  template <typename T>
+  constexpr format_literal closer(const T&) const
+  { return "}"; }
+
+  // use [] for vectors and arrays
+  template <typename T>
+  constexpr format_literal opener(const std::vector<T>&) const
+  { return "["; }
+
+  template <typename T>
+  constexpr format_literal closer(const std::vector<T>&) const
+  { return "]"; }
+
+  template <typename T, size_t N>
+  constexpr format_literal opener(const std::array<T, N>&) const
+  { return "["; }
+
+  template <typename T, size_t N>
+  constexpr format_literal closer(const std::array<T, N>&) const
+  { return "]"; }
+
+  template <typename T, size_t N>
+  constexpr format_literal opener(const T(&)[N]) const
+  { return "["; }
+
+  template <typename T, size_t N>
+  constexpr format_literal closer(const T(&)[N]) const
+  { return "]"; }
+
+  // use () for pairs and tuples
+  template <typename T, typename U>
+  constexpr format_literal opener(const std::pair<T, U>&) const
+  { return "("; }
+
+  template <typename T, typename U>
+  constexpr format_literal closer(const std::pair<T, U>&) const
+  { return ")"; }
+
+  template <typename... Ts>
+  constexpr format_literal opener(const std::tuple<Ts...>&) const
+  { return "("; }
+
+  template <typename... Ts>
+  constexpr format_literal closer(const std::tuple<Ts...>&) const
+  { return ")"; }
+
+  // use double quotes for strings
+  constexpr format_literal opener(const std::string&) const
+  { return "\""; }
+
+  constexpr format_literal closer(const std::string&) const
+  { return "\""; }
+
+  constexpr format_literal opener(const char* const) const
+  { return "\""; }
+
+  constexpr format_literal closer(const char* const) const
+  { return "\""; }
+
+  // and for wide strings
+  template <typename C, typename Tr, typename A>
+  constexpr std::enable_if_t<detail::is_wide_char<C>::value, format_literal>
+  opener(const std::basic_string<C, Tr, A>&) const
+  { return "\""; }
+
+  template <typename C, typename Tr, typename A>
+  constexpr std::enable_if_t<detail::is_wide_char<C>::value, format_literal>
+  closer(const std::basic_string<C, Tr, A>&) const
+  { return "\""; }
+
+  template <typename C>
+  constexpr std::enable_if_t<detail::is_wide_char<C>::value, format_literal>
+  opener(const C* const) const
+  { return "\""; }
+
+  template <typename C>
+  constexpr std::enable_if_t<detail::is_wide_char<C>::value, format_literal>
+  closer(const C* const) const
+  { return "\""; }
+};
+
+// -----------------------------------------------------------------------------
+// Formatter hooks. A formatter derived from default_formatter that overloads
+// (say) opener for one type hides the base class openers for every other
+// type, so when a formatter has no hook for a type, default_formatter's is
+// used.
+namespace detail
+{
+#define FORMATTER_HOOK(name)                                            \
+  template <typename F, typename T>                                     \
+  constexpr auto name(const F& f, const T& t, int)                      \
+    -> decltype(f.name(t))                                              \
+  { return f.name(t); }                                                 \
+  template <typename F, typename T>                                     \
+  constexpr auto name(const F&, const T& t, long)                       \
+    -> decltype(default_formatter().name(t))                            \
+  { return default_formatter().name(t); }                               \
+  template <typename F, typename T>                                     \
+  constexpr decltype(auto) name(const F& f, const T& t)                 \
+  { return name(f, t, 0); }
+
+  FORMATTER_HOOK(opener)
+  FORMATTER_HOOK(closer)
+  FORMATTER_HOOK(separator)
+
+#undef FORMATTER_HOOK
+
+  // Map entries are output with kv_opener, kv_separator and kv_closer, which
+  // by default are whatever the formatter uses for the entry's pair type.
+#define KV_HOOK(name, fallback)                                         \
+  template <typename F, typename M, typename E>                         \
+  constexpr auto name(const F& f, const M& m, const E&, int)            \
+    -> decltype(f.name(m))                                              \
+  { return f.name(m); }                                                 \
+  template <typename F, typename M, typename E>                         \
+  constexpr decltype(auto) name(const F& f, const M&, const E& e, long) \
+  { return fallback(f, e); }                                            \
+  template <typename F, typename M, typename E>                         \
+  constexpr decltype(auto) name(const F& f, const M& m, const E& e)     \
+  { return name(f, m, e, 0); }
+
+  KV_HOOK(kv_opener, opener)
+  KV_HOOK(kv_separator, separator)
+  KV_HOOK(kv_closer, closer)
+
+#undef KV_HOOK
+
+#define FORMATTER_OPTION(name)                                          \
+  template <typename F>                                                 \
+  constexpr auto name(const F& f, int) -> decltype(f.name())            \
+  { return f.name(); }                                                  \
+  template <typename F>                                                 \
+  constexpr auto name(const F&, long)                                   \
+    -> decltype(default_formatter().name())                             \
+  { return default_formatter().name(); }                                \
+  template <typename F>                                                 \
+  constexpr decltype(auto) name(const F& f)                             \
+  { return name(f, 0); }
+
+  FORMATTER_OPTION(max_elements)
+  FORMATTER_OPTION(max_depth)
+  FORMATTER_OPTION(max_bytes)
+  FORMATTER_OPTION(escape_strings)
+  FORMATTER_OPTION(validate_utf8)
+  FORMATTER_OPTION(sort_unordered)
+  FORMATTER_OPTION(max_threads)
+  FORMATTER_OPTION(quote_values)
+  FORMATTER_OPTION(quote_keys)
+  FORMATTER_OPTION(null_literal)
+  FORMATTER_OPTION(nonfinite_as_null)
+  FORMATTER_OPTION(indent_width)
+  FORMATTER_OPTION(follow_pointers)
+  FORMATTER_OPTION(bytes_as)
+  FORMATTER_OPTION(time_stats)
+
+#undef FORMATTER_OPTION
+
+  // The formatter used when none is given. Stringifiers hold their formatter
+  // by reference, so this must outlive them.
+  inline const default_formatter& default_formatter_instance()
+  {
+    static constexpr default_formatter f{};
+    return f;
+  }
+} // detail
+
+// -----------------------------------------------------------------------------
+// A formatter for JSON output: [] for sequences (including pairs and tuples),
+// {} for maps with "key":value entries (see quote_keys), null for
+// nullptr and non-finite numbers, and escaped strings. Characters and values
+// output with operator<< that aren't numbers are output as strings.
+struct json_formatter : public default_formatter
+{
+  template <typename T>
+  constexpr std::enable_if_t<!detail::is_map<T>::value
+                             && !detail::is_wide_string<T>::value,
+                             format_literal>
+  opener(const T&) const
+  { return "["; }
+
+  template <typename T>
+  constexpr std::enable_if_t<!detail::is_map<T>::value
+                             && !detail::is_wide_string<T>::value,
+                             format_literal>
+  closer(const T&) const
+  { return "]"; }
+
+  template <typename T>
+  constexpr std::enable_if_t<detail::is_map<T>::value, format_literal>
+  opener(const T&) const
+  { return "{"; }
+
+  template <typename T>
+  constexpr std::enable_if_t<detail::is_map<T>::value, format_literal>
+  closer(const T&) const
+  { return "}"; }
+
+  constexpr format_literal opener(const std::string&) const
+  { return "\""; }
+
+  constexpr format_literal closer(const std::string&) const
+  { return "\""; }
+
+  constexpr format_literal opener(const char* const) const
+  { return "\""; }
+
+  constexpr format_literal closer(const char* const) const
+  { return "\""; }
+
+  template <typename T>
+  constexpr std::enable_if_t<detail::is_wide_string<T>::value, format_literal>
+  opener(const T&) const
+  { return "\""; }
+
+  template <typename T>
+  constexpr std::enable_if_t<detail::is_wide_string<T>::value, format_literal>
+  closer(const T&) const
+  { return "\""; }
+
+  template <typename M>
+  constexpr format_literal kv_opener(const M&) const
+  { return ""; }
+
+  template <typename M>
+  constexpr format_literal kv_separator(const M&) const
+  { return ":"; }
+
+  template <typename M>
+  constexpr format_literal kv_closer(const M&) const
+  { return ""; }
+
+  constexpr bool escape_strings() const { return true; }
+  constexpr bool quote_values() const { return true; }
+  constexpr bool quote_keys() const { return true; }
+  constexpr format_literal null_literal() const { return "null"; }
+  constexpr bool nonfinite_as_null() const { return true; }
+};
+
+// -----------------------------------------------------------------------------
+// The function that drives it all
+template <typename T>
+inline stringifier<std::remove_reference_t<T>, default_formatter>
+prettyprint(T&& t)
+{
+  return stringifier<std::remove_reference_t<T>, default_formatter>(
+      std::forward<T>(t), detail::default_formatter_instance());
+}
+
+template <typename T, typename F>
+inline stringifier<std::remove_reference_t<T>, std::decay_t<F>>
+prettyprint(T&& t, F&& f)
+{
+  return stringifier<std::remove_reference_t<T>, std::decay_t<F>>(
+      std::forward<T>(t), std::forward<F>(f));
+}
+
+namespace detail
+{
+  template <typename S>
+  inline void output_text(S& s, const char* p, std::size_t n, bool escape)
+  {
+    if (escape)
+      output_escaped(s, p, n);
+    else
+      write_ref(s, p, n);
+  }
+
+  // The valid runs are output as they are, with each invalid sequence
+  // replaced.
+  template <typename S>
+  inline void output_valid_utf8(S& s, const char* p, std::size_t n,
+                                bool escape)
+  {
+    const char* end = p + n;
+    const char* q = p;
+    while (q != end)
+    {
+      q = skip_ascii(q, end);
+      if (q == end)
+        break;
+      const std::ptrdiff_t len = utf8_sequence(q, end);
+      if (len > 0)
+      {
+        q += len;
+        continue;
+      }
+      if (q != p)
+        output_text(s, p, static_cast<std::size_t>(q - p), escape);
+      s.write(utf8_replacement, sizeof(utf8_replacement) - 1);
+      q -= len;
+      p = q;
+    }
+    if (q != p)
+      output_text(s, p, static_cast<std::size_t>(q - p), escape);
+  }
+
+  template <typename S, typename F>
+  inline void output_string(S& s, const char* p, std::size_t n, const F& f)
+  {
+    if (validate_utf8(f))
+      output_valid_utf8(s, p, n, escape_strings(f));
+    else
+      output_text(s, p, n, escape_strings(f));
+  }
+
+  // Forwards to a sink, but without write_ref: for strings that are formatted
+  // on the fly and won't outlive the call.
+  template <typename S>
+  struct copying_sink
+  {
+    void write(const char* p, std::size_t n) { s.write(p, n); }
+    void put(char c) { s.put(c); }
+    std::ostream& stream() { return s.stream(); }
+    S& s;
+  };
+
+  template <typename S, typename F>
+  inline void output_quoted(S& s, const char* p, std::size_t n, const F& f)
+  {
+    copying_sink<S> c{s};
+    emit(s, opener(f, p));
+    output_string(c, p, n, f);
+    emit(s, closer(f, p));
+  }
+
+  // Wide characters are converted a buffer at a time, so the converted text
+  // (which is valid UTF-8 by construction) doesn't outlive the call.
+  template <typename S, typename C>
+  inline void output_utf8(S& s, const C* p, std::size_t n, bool escape)
+  {
+    copying_sink<S> c{s};
+    char buf[512];
+    constexpr std::size_t code_point_room = 4;
+    const C* end = p + n;
+    std::size_t used = 0;
+    while (p != end)
+    {
+      const std::size_t ascii = narrow_ascii(
+          buf + used, p,
+          std::min(static_cast<std::size_t>(end - p),
+                   sizeof(buf) - used - code_point_room));
+      used += ascii;
+      p += ascii;
+      if (p != end && static_cast<std::uint32_t>(*p) >= 0x80)
+        used += encode_utf8(buf + used, decode_wide(p, end));
+      if (sizeof(buf) - used <= code_point_room)
+      {
+        output_text(c, buf, used, escape);
+        used = 0;
+      }
+    }
+    output_text(c, buf, used, escape);
+  }
+
+  // (with the string's own text, for cbor)
+  template <typename C, typename Tr, typename A>
+  inline std::pair<const C*, std::size_t>
+  wide_text(const std::basic_string<C, Tr, A>& t)
+  {
+    return {t.data(), t.size()};
+  }
+
+#ifdef PRETTYPRINT_HAS_STRING_VIEW
+  template <typename C, typename Tr>
+  inline std::pair<const C*, std::size_t>
+  wide_text(std::basic_string_view<C, Tr> t)
+  {
+    return {t.data(), t.size()};
+  }
+#endif
+
+  template <typename C>
+  inline std::pair<const C*, std::size_t> wide_text(const C* t)
+  {
+    return {t, t ? std::char_traits<C>::length(t) : 0};
+  }
+
+  template <typename C>
+  inline std::enable_if_t<is_wide_char<C>::value,
+                          std::pair<const C*, std::size_t>>
+  wide_text(const C& t)
+  {
+    return {&t, 1};
+  }
+
+  // Wide strings are quoted like strings, and wide characters (and string
+  // views) like the narrow ones are.
+  template <typename T>
+  struct is_wide_quoted : public std::false_type {};
+  template <typename C, typename Tr, typename A>
+  struct is_wide_quoted<std::basic_string<C, Tr, A>> : public std::true_type {};
+  template <typename C>
+  struct is_wide_quoted<C*> : public std::true_type {};
+  template <typename C, std::size_t N>
+  struct is_wide_quoted<C[N]> : public std::true_type {};
+
+  template <typename C, typename Tr, typename A>
+  inline const std::basic_string<C, Tr, A>&
+  wide_quoted(const std::basic_string<C, Tr, A>& t) { return t; }
+
+  template <typename C>
+  inline const C* wide_quoted(const C* t) { return t; }
+
+  template <typename S, typename T, typename F>
+  inline void output_wide(S& s, const T& t, const F& f, std::true_type)
+  {
+    const auto text = wide_text(t);
+    emit(s, opener(f, wide_quoted(t)));
+    output_utf8(s, text.first, text.second, escape_strings(f));
+    emit(s, closer(f, wide_quoted(t)));
+  }
+
+  template <typename S, typename T, typename F>
+  inline void output_wide(S& s, const T& t, const F& f, std::false_type)
+  {
+    const auto text = wide_text(t);
+    if (!quote_values(f))
+      return output_utf8(s, text.first, text.second, false);
+    const char* q = "";
+    emit(s, opener(f, q));
+    output_utf8(s, text.first, text.second, escape_strings(f));
+    emit(s, closer(f, q));
+  }
+
+  // Output a value that has operator<<, according to the formatter.
+  template <typename S, typename T, typename F>
+  inline std::enable_if_t<is_formatted_integer<T>::value>
+  output_formatted(S& s, T t, const F&)
+  {
+    output_value(s, t);
+  }
+
+  template <typename S, typename T, typename F>
+  inline std::enable_if_t<std::is_floating_point<T>::value>
+  output_formatted(S& s, T t, const F& f)
+  {
+    if (nonfinite_as_null(f) && !std::isfinite(t))
+      emit(s, null_literal(f));
+    else
+      output_value(s, t);
+  }
+
+  template <typename S, typename T, typename F>
+  inline std::enable_if_t<!is_formatted_integer<T>::value
+                          && !std::is_floating_point<T>::value>
+  output_formatted(S& s, const T& t, const F& f)
+  {
+    if (!quote_values(f))
+      return output_value(s, t);
+    string_sink<scratch_allocator<char>> b;
+    output_value(b, t);
+    output_quoted(s, b.data(), b.size(), f);
+  }
+
+  // Text standing in for a value (like <callable (function)>) is quoted like
+  // any other value. It never needs escaping.
+  template <typename S, typename F>
+  inline void output_placeholder(S& s, const char* p, const F& f)
+  {
+    if (quote_values(f))
+      emit(s, opener(f, p));
+    emit(s, p);
+    if (quote_values(f))
+      emit(s, closer(f, p));
+  }
+
+  // ---------------------------------------------------------------------------
+  // Per-call state, for enforcing a formatter's limits. Each top-level call
+  // (operator<< or prettyprint_to) gets its own, saving and restoring any
+  // enclosing call's (a type's operator<< may itself use prettyprint).
+  SFINAE_DETECT(member_size, std::declval<const T&>().size())
+
+  template <typename S>
+  inline std::enable_if_t<has_member_size<S>::value, std::size_t>
+  sink_size(const S& s) { return s.size(); }
+
+  template <typename S>
+  inline std::enable_if_t<!has_member_size<S>::value, std::size_t>
+  sink_size(const S&) { return 0; }
+
+  // The objects reached through pointers so far, when following them, with
+  // the ids they were given. An open-addressing hash set that only allocates
+  // once it outgrows its inline table.
+  class visited_set
+  {
+  public:
+    visited_set() {}
+    visited_set(const visited_set&) = delete;
+    visited_set& operator=(const visited_set&) = delete;
+
+    // Returns the object's id, and whether it was there already.
+    std::pair<std::size_t, bool> insert(const void* p, const void* type)
+    {
+      if ((m_count + 1) * 2 > m_capacity)
+        grow();
+      slot* slots = table();
+      for (std::size_t i = hash(p) & (m_capacity - 1); ;
+           i = (i + 1) & (m_capacity - 1))
+      {
+        if (!slots[i].p)
+        {
+          slots[i] = slot{p, type, ++m_count};
+          return {m_count, false};
+        }
+        if (slots[i].p == p && slots[i].type == type)
+          return {slots[i].id, true};
+      }
+    }
+
+  private:
+    struct slot
+    {
+      const void* p;
+      const void* type;
+      std::size_t id;
+    };
+
+    static constexpr std::size_t inline_capacity = 32;
+
+    static std::size_t hash(const void* p)
+    {
+      const auto h = reinterpret_cast<std::uintptr_t>(p) >> 3;
+      return static_cast<std::size_t>(h * 0x9e3779b97f4a7c15ull >> 16);
+    }
+
+    slot* table() { return m_heap.empty() ? m_inline : m_heap.data(); }
+
+    // The inline table isn't initialized until it's needed.
+    void grow()
+    {
+      if (m_capacity == 0)
+      {
+        m_capacity = inline_capacity;
+        std::fill(m_inline, m_inline + inline_capacity, slot{nullptr, nullptr, 0});
+        return;
+      }
+      const slot* old = table();
+      const std::size_t old_capacity = m_capacity;
+      std::vector<slot, scratch_allocator<slot>> heap(
+          old_capacity * 2, slot{nullptr, nullptr, 0});
+      m_capacity = old_capacity * 2;
+      for (std::size_t j = 0; j < old_capacity; ++j)
+      {
+        if (!old[j].p)
+          continue;
+        std::size_t i = hash(old[j].p) & (m_capacity - 1);
+        while (heap[i].p)
+          i = (i + 1) & (m_capacity - 1);
+        heap[i] = old[j];
+      }
+      m_heap = std::move(heap);
+    }
+
+    slot m_inline[inline_capacity];
+    std::vector<slot, scratch_allocator<slot>> m_heap;
+    std::size_t m_capacity = 0;
+    std::size_t m_count = 0;
+  };
+
+  // What a call has done so far, for formatters with report_stats(). Time
+  // spent in nested values is subtracted from the time for their container.
+  struct stats_state
+  {
+    prettyprint_stats stats;
+    std::chrono::steady_clock::duration nested{};
+  };
+
+  struct output_state
+  {
+    std::size_t depth;
+    std::size_t start;
+    visited_set* visited;
+    stats_state* stats;
+    // inside a container that is being output in parallel (see
+    // output_parallel), on this thread
+    bool parallel;
+  };
+
+  inline output_state& current_output()
+  {
+    static thread_local output_state state{0, 0, nullptr, nullptr, false};
+    return state;
+  }
+
+  struct depth_guard
+  {
+    depth_guard() { ++current_output().depth; }
+    depth_guard(const depth_guard&) = delete;
+    depth_guard& operator=(const depth_guard&) = delete;
+    ~depth_guard() { --current_output().depth; }
+  };
+
+  SFINAE_DETECT(end_output, (std::declval<T&>().end_output(), 0))
+
+  template <typename S>
+  inline std::enable_if_t<has_end_output<S>::value> end_output(S& s)
+  { s.end_output(); }
+
+  template <typename S>
+  inline std::enable_if_t<!has_end_output<S>::value> end_output(S&) {}
+
+  template <typename S>
+  class output_scope
+  {
+  public:
+    explicit output_scope(S& s)
+      : m_s(s)
+      , m_saved(current_output())
+    {
+      current_output() =
+        output_state{0, sink_size(s), &m_visited, nullptr, m_saved.parallel};
+    }
+    output_scope(const output_scope&) = delete;
+    output_scope& operator=(const output_scope&) = delete;
+    ~output_scope()
+    {
+      current_output() = m_saved;
+      end_output(m_s);
+    }
+
+  private:
+    S& m_s;
+    output_state m_saved;
+    visited_set m_visited;
+  };
+
+  // ---------------------------------------------------------------------------
+  // Gathering stats
+  SFINAE_DETECT(report_stats,
+                (std::declval<const T&>().report_stats(
+                    std::declval<const prettyprint_stats&>()), 0))
+
+  constexpr stats_category category(is_wide_string_tag)
+  { return stats_category::outputtable; }
+  constexpr stats_category category(is_outputtable_tag)
+  { return stats_category::outputtable; }
+  constexpr stats_category category(is_enum_tag)
+  { return stats_category::enumeration; }
+  constexpr stats_category category(is_callable_tag)
+  { return stats_category::callable; }
+  constexpr stats_category category(is_map_tag)
+  { return stats_category::map; }
+  constexpr stats_category category(is_iterable_tag)
+  { return stats_category::iterable; }
+  constexpr stats_category category(is_pair_tag)
+  { return stats_category::pair; }
+  constexpr stats_category category(is_tuple_tag)
+  { return stats_category::tuple; }
+  constexpr stats_category category(is_aggregate_tag)
+  { return stats_category::aggregate; }
+  constexpr stats_category category(is_unprintable_tag)
+  { return stats_category::unprintable; }
+  constexpr stats_category category(is_cbor_tag)
+  { return stats_category::cbor; }
+
+  template <typename Str>
+  struct stringifier_category;
+  template <typename T, typename F, typename TAG>
+  struct stringifier_category<stringifier_select<T, F, TAG>>
+  {
+    static constexpr stats_category value = category(TAG{});
+  };
+
+  // Count n elements output at the current depth.
+  template <typename F>
+  inline void count_elements(const F&, std::size_t n)
+  {
+    if (!has_report_stats<F>::value)
+      return;
+    if (stats_state* st = current_output().stats)
+    {
+      st->stats.elements += n;
+      st->stats.max_depth = std::max(st->stats.max_depth,
+                                     current_output().depth);
+    }
+  }
+
+  template <typename S, typename Str, typename F>
+  inline S& output_timed(S& s, const Str& str, const F&, std::false_type)
+  {
+    return str.output(s);
+  }
+
+  template <typename S, typename Str, typename F>
+  inline S& output_timed(S& s, const Str& str, const F& f, std::true_type)
+  {
+    stats_state* st = current_output().stats;
+    if (!st || !time_stats(f))
+      return str.output(s);
+    using clock = std::chrono::steady_clock;
+    const clock::duration saved = st->nested;
+    st->nested = clock::duration{};
+    const auto start = clock::now();
+    str.output(s);
+    const auto elapsed = clock::now() - start;
+    st->stats.times[static_cast<std::size_t>(
+        stringifier_category<Str>::value)] +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          elapsed - st->nested);
+    st->nested = saved + elapsed;
+    return s;
+  }
+
+  // Nested values are output with the same formatter as their container.
+  template <typename S, typename T, typename F>
+  inline S& output_nested(S& s, T&& t, const F& f)
+  {
+    count_elements(f, 1);
+    return output_timed(s, prettyprint(std::forward<T>(t), f), f,
+                        has_report_stats<F>{});
+  }
+
+  template <typename S, typename Str>
+  inline S& output_reported(S& s, const Str& str, long)
+  {
+    return str.output(s);
+  }
+
+  template <typename S, typename Str>
+  inline auto output_reported(S& s, const Str& str, int)
+    -> std::enable_if_t<
+         has_report_stats<std::decay_t<decltype(str.m_f)>>::value, S&>
+  {
+    stats_state st;
+    current_output().stats = &st;
+    const std::size_t start = sink_size(s);
+    output_timed(s, str, str.m_f, std::true_type{});
+    st.stats.bytes = sink_size(s) - start;
+    current_output().stats = nullptr;
+    str.m_f.report_stats(st.stats);
+    return s;
+  }
+} // detail
+
+// -----------------------------------------------------------------------------
+// Multi-line layout. A formatter that has
+//
+//   std::size_t line_width() const;
+//
+// gets output that is broken across lines, with indent_width() of indentation
+// per level, wherever a container (or pair or tuple) doesn't fit on the rest
+// of the line: each element goes on its own line, and the closer on a line
+// after them. Anything that fits stays on one line, as usual.
+//
+// The layout is done in one pass (after Oppen): output is held back from the
+// start of the outermost container that might still fit, and once more than
+// the rest of the line is held, that container is broken and what's held of
+// it is written out. So no more than about a line is held at once.
+namespace detail
+{
+  SFINAE_DETECT(line_width, std::declval<const T&>().line_width())
+  SFINAE_DETECT(begin_group, (std::declval<T&>().begin_group(), 0))
+
+  template <typename S>
+  class layout_sink
+  {
+  public:
+    layout_sink(S& s, std::size_t width, std::size_t indent)
+      : m_s(s)
+      , m_width(width)
+      , m_indent(indent)
+    {}
+    layout_sink(const layout_sink&) = delete;
+    layout_sink& operator=(const layout_sink&) = delete;
+
+    void write(const char* p, std::size_t n)
+    {
+      m_size += n;
+      if (m_pending.empty())
+        return print_text(p, n);
+      m_tokens.push_back({token::text, scratch_string(p, n), 0});
+      m_pos += n;
+      break_overflowing();
+    }
+
+    void put(char c) { write(&c, 1); }
+
+    std::ostream& stream()
+    {
+      if (!m_stream)
+      {
+        m_stream = std::make_unique<sink_ostream<layout_sink>>(*this);
+        if (!default_format())
+          m_stream->copyfmt(m_s.stream());
+      }
+      return *m_stream;
+    }
+
+    bool default_format() const { return detail::default_format(m_s); }
+
+    // bytes written, not counting line breaks and indentation
+    std::size_t size() const { return m_size; }
+
+    void end_output() { detail::end_output(m_s); }
+
+    void begin_group()
+    {
+      ++m_depth;
+      m_groups.push_back({m_pos, npos});
+      m_pending.push_back(m_groups.size() - 1);
+      m_tokens.push_back({token::begin, scratch_string(), m_groups.size() - 1});
+    }
+
+    void end_group()
+    {
+      --m_depth;
+      if (m_pending.empty())
+        return print({token::end, scratch_string(), 0});
+
+      // the innermost group is the last pending one
+      const std::size_t g = m_pending.back();
+      m_groups[g].width = m_pos - m_groups[g].start;
+      m_pending.pop_back();
+      m_tokens.push_back({token::end, scratch_string(), g});
+      if (m_pending.empty())
+        print_held(npos);
+    }
+
+    // A place to break the line: between elements, or (closing) before the
+    // closer.
+    void line_break(bool closing)
+    {
+      const std::size_t indent = (closing ? m_depth - 1 : m_depth) * m_indent;
+      if (m_pending.empty())
+        return print({token::line_break, scratch_string(), indent});
+      m_tokens.push_back({token::line_break, scratch_string(), indent});
+    }
+
+  private:
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+    struct token
+    {
+      enum kind_t { text, begin, end, line_break } kind;
+      scratch_string str;
+      std::size_t n;  // group for begin/end, indentation for line_break
+    };
+
+    struct group
+    {
+      std::size_t start;
+      std::size_t width;  // npos until it ends
+    };
+
+    void print_text(const char* p, std::size_t n)
+    {
+      m_s.write(p, n);
+      const void* nl = std::memchr(p, '\n', n);
+      if (!nl)
+      {
+        m_column += n;
+        return;
+      }
+      const char* last = p + n;
+      while (*--last != '\n') {}
+      m_column = static_cast<std::size_t>(p + n - last - 1);
+    }
+
+    // A group is laid out flat if its enclosing group is, or if it fits.
+    // Groups that haven't ended (because they are too wide to be held) are
+    // broken.
+    void print(const token& t)
+    {
+      if (t.kind == token::text)
+      {
+        print_text(t.str.data(), t.str.size());
+      }
+      else if (t.kind == token::begin)
+      {
+        const std::size_t w = m_groups[t.n].width;
+        m_flat.push_back((!m_flat.empty() && m_flat.back())
+                         || (w != npos && m_column + w <= m_width));
+      }
+      else if (t.kind == token::end)
+      {
+        m_flat.pop_back();
+      }
+      else if (!m_flat.empty() && !m_flat.back())
+      {
+        m_s.put('\n');
+        for (std::size_t i = 0; i < t.n; ++i)
+          m_s.put(' ');
+        m_column = t.n;
+      }
+    }
+
+    // Write out held tokens, up to the start of group g.
+    void print_held(std::size_t g)
+    {
+      while (!m_tokens.empty())
+      {
+        const token& t = m_tokens.front();
+        if (t.kind == token::begin && t.n == g)
+          break;
+        print(t);
+        m_tokens.pop_front();
+      }
+      if (m_tokens.empty())
+        m_groups.clear();
+    }
+
+    // Break the outermost pending groups for as long as they can't fit.
+    void break_overflowing()
+    {
+      while (!m_pending.empty()
+             && m_column + m_pos - m_groups[m_pending.front()].start > m_width)
+      {
+        m_pending.pop_front();
+        print_held(m_pending.empty() ? npos : m_pending.front());
+      }
+    }
+
+    S& m_s;
+    std::size_t m_width;
+    std::size_t m_indent;
+    std::size_t m_size = 0;
+    std::size_t m_column = 0;
+    std::size_t m_depth = 0;
+    std::size_t m_pos = 0;  // width of everything held, if laid out flat
+    std::deque<token, scratch_allocator<token>> m_tokens;
+    std::vector<group, scratch_allocator<group>> m_groups;
+    // held groups that haven't ended
+    std::deque<std::size_t, scratch_allocator<std::size_t>> m_pending;
+    // for the groups being written out
+    std::vector<bool, scratch_allocator<bool>> m_flat;
+    std::unique_ptr<sink_ostream<layout_sink>> m_stream;
+  };
+
+  // Containers, pairs and tuples mark themselves out for a layout.
+  template <typename S>
+  inline std::enable_if_t<has_begin_group<S>::value> begin_group(S& s)
+  { s.begin_group(); }
+
+  template <typename S>
+  inline std::enable_if_t<!has_begin_group<S>::value> begin_group(S&) {}
+
+  template <typename S>
+  inline std::enable_if_t<has_begin_group<S>::value> end_group(S& s)
+  { s.end_group(); }
+
+  template <typename S>
+  inline std::enable_if_t<!has_begin_group<S>::value> end_group(S&) {}
+
+  template <typename S>
+  inline std::enable_if_t<has_begin_group<S>::value>
+  line_break(S& s, bool closing = false)
+  { s.line_break(closing); }
+
+  template <typename S>
+  inline std::enable_if_t<!has_begin_group<S>::value>
+  line_break(S&, bool = false) {}
+
+  // Output a top-level stringifier. Only those with a formatter (m_f) have
+  // anything to lay out.
+  template <typename S, typename Str>
+  inline S& output_top(S& s, const Str& str, long)
+  {
+    output_scope<S> scope(s);
+    return output_reported(s, str, 0);
+  }
+
+  template <typename S, typename Str>
+  inline auto output_top(S& s, const Str& str, int)
+    -> std::enable_if_t<has_line_width<std::decay_t<decltype(str.m_f)>>::value,
+                        S&>
+  {
+    layout_sink<S> l(s, str.m_f.line_width(), indent_width(str.m_f));
+    output_scope<layout_sink<S>> scope(l);
+    output_reported(l, str, 0);
+    return s;
+  }
+} // detail
+
+// Format directly into a sink
+template <typename S, typename T>
+inline S& prettyprint_to(S& s, T&& t)
+{
+  detail::output_scope<S> scope(s);
+  return prettyprint(std::forward<T>(t)).output(s);
+}
+
+template <typename S, typename T, typename F>
+inline S& prettyprint_to(S& s, T&& t, F&& f)
+{
+  return detail::output_top(
+      s, prettyprint(std::forward<T>(t), std::forward<F>(f)), 0);
+}
+
+// The size of the output, without producing it
+template <typename T>
+inline std::size_t prettyprint_size(T&& t)
+{
+  counting_sink s;
+  return prettyprint_to(s, std::forward<T>(t)).size();
+}
+
+template <typename T, typename F>
+inline std::size_t prettyprint_size(T&& t, F&& f)
+{
+  counting_sink s;
+  return prettyprint_to(s, std::forward<T>(t), std::forward<F>(f)).size();
+}
+
+// -----------------------------------------------------------------------------
+// Formatting to strings. Each thread keeps a buffer to format into, so that
+// (after warming up) formatting allocates nothing but the result, and does
+// it once at the right size. The buffer's stream (if needed) is kept too.
+namespace detail
+{
+  // Buffers bigger than this aren't kept after use.
+  constexpr std::size_t max_thread_buffer = 1024 * 1024;
+
+  struct thread_buffer
+  {
+    buffer_sink sink;
+    bool in_use = false;
+  };
+
+  inline thread_buffer& this_thread_buffer()
+  {
+    static thread_local thread_buffer b;
+    return b;
+  }
+
+  // The thread's buffer, unless it is already in use further up the stack (a
+  // type's operator<< may itself format to a string), in which case a
+  // buffer of our own.
+  class scratch_buffer
+  {
+  public:
+    scratch_buffer()
+      : m_thread(this_thread_buffer())
+      , m_owned(m_thread.in_use ? std::make_unique<buffer_sink>() : nullptr)
+    {
+      m_thread.in_use = true;
+    }
+    scratch_buffer(const scratch_buffer&) = delete;
+    scratch_buffer& operator=(const scratch_buffer&) = delete;
+
+    ~scratch_buffer()
+    {
+      if (!m_owned)
+      {
+        m_thread.sink.clear();
+        m_thread.sink.shrink(max_thread_buffer);
+        m_thread.in_use = false;
+      }
+    }
+
+    buffer_sink& sink() { return m_owned ? *m_owned : m_thread.sink; }
+
+  private:
+    thread_buffer& m_thread;
+    std::unique_ptr<buffer_sink> m_owned;
+  };
+} // detail
+
+// Format to a string
+template <typename T>
+inline std::string prettyprint_to_string(T&& t)
+{
+  detail::scratch_buffer b;
+  return prettyprint_to(b.sink(), std::forward<T>(t)).str();
+}
+
+template <typename T, typename F>
+inline std::string prettyprint_to_string(T&& t, const F& f)
+{
+  detail::scratch_buffer b;
+  return prettyprint_to(b.sink(), std::forward<T>(t), f).str();
+}
+
+// Format to a string that uses an allocator, with the scratch memory used
+// along the way coming from it as well.
+template <typename A, typename T>
+inline std::basic_string<char, std::char_traits<char>, A>
+prettyprint_to_string(std::allocator_arg_t, const A& a, T&& t)
+{
+  return prettyprint_to_string(std::allocator_arg, a, std::forward<T>(t),
+                               detail::default_formatter_instance());
+}
+
+template <typename A, typename T, typename F>
+inline std::basic_string<char, std::char_traits<char>, A>
+prettyprint_to_string(std::allocator_arg_t, const A& a, T&& t,
+                      const F& f)
+{
+  detail::allocator_resource<A> r(a);
+  detail::scratch_scope scope(&r);
+  string_sink<A> s(a);
+  return prettyprint_to(s, std::forward<T>(t), f).release();
+}
+
+#ifdef PRETTYPRINT_HAS_PMR
+// These take a pointer to any kind of memory resource: with a conversion to
+// std::pmr::memory_resource*, (&r, x) would be taken as printing &r with x as
+// the formatter.
+template <typename R, typename T,
+          typename = std::enable_if_t<
+            std::is_base_of<std::pmr::memory_resource, R>::value>>
+inline std::pmr::string prettyprint_to_string(R* r, T&& t)
+{
+  return prettyprint_to_string(std::allocator_arg,
+                               std::pmr::polymorphic_allocator<char>(r),
+                               std::forward<T>(t));
+}
+
+template <typename R, typename T, typename F,
+          typename = std::enable_if_t<
+            std::is_base_of<std::pmr::memory_resource, R>::value>>
+inline std::pmr::string prettyprint_to_string(R* r, T&& t, const F& f)
+{
+  return prettyprint_to_string(std::allocator_arg,
+                               std::pmr::polymorphic_allocator<char>(r),
+                               std::forward<T>(t), f);
+}
+#endif
+
+// Format to a string by handing over the thread's buffer, avoiding the copy
+// that prettyprint_to_string makes. The result may have spare capacity; pass
+// it to prettyprint_recycle when done with it to have it reused.
+template <typename T>
+inline std::string prettyprint_to_buffer(T&& t)
+{
+  detail::scratch_buffer b;
+  return prettyprint_to(b.sink(), std::forward<T>(t)).release();
+}
+
+template <typename T, typename F>
+inline std::string prettyprint_to_buffer(T&& t, const F& f)
+{
+  detail::scratch_buffer b;
+  return prettyprint_to(b.sink(), std::forward<T>(t), f).release();
+}
+
+inline void prettyprint_recycle(std::string&& s)
+{
+  detail::thread_buffer& b = detail::this_thread_buffer();
+  if (!b.in_use && s.capacity() <= detail::max_thread_buffer)
+    b.sink.recycle(std::move(s));
+}
+
+namespace detail
+{
+  // A stream's width applies to the whole output, as it would to a string,
+  // rather than to whatever is first formatted through the stream: padded
+  // output is formatted on the side (with the stream's format) first.
+  template <typename Out>
+  inline std::ostream& output_padded(std::ostream& s, Out out)
+  {
+    if (s.width() == 0)
+    {
+      ostream_sink sink(s);
+      out(sink);
+      return s;
+    }
+    std::ostringstream padded;
+    padded.copyfmt(s);
+    padded.width(0);
+    {
+      ostream_sink sink(padded);
+      out(sink);
+    }
+    return s << padded.str();
+  }
+} // detail
+
+template <typename T, typename F>
+inline std::ostream& operator<<(std::ostream& s, const stringifier<T, F>& t)
+{
+  return detail::output_padded(
+      s, [&t] (ostream_sink& sink) { detail::output_top(sink, t, 0); });
+}
+
+// -----------------------------------------------------------------------------
+// Deferred formatting. prettyprint_deferred(x[, formatter]) captures a copy of
+// x (and the formatter) in a type-erased, move-only record, to be formatted
+// later, perhaps on another thread. This is for hot logging call sites: the
+// record is cheap to make and to move through a queue, and small values are
+// held inline, without allocating. Since it is formatted later, what it holds
+// has to be a copy: C strings (narrow or wide) are copied into a
+// std::basic_string and built-in arrays into a std::array, rather than
+// capturing a pointer that might dangle.
+namespace detail
+{
+  template <typename C>
+  struct is_text_char
+    : public std::integral_constant<bool, std::is_same<C, char>::value
+                                    || is_wide_char<C>::value>
+  {};
+
+  template <typename T, typename = void>
+  struct deferred_type { using type = T; };
+  template <typename C, std::size_t N>
+  struct deferred_type<C[N], std::enable_if_t<is_text_char<C>::value>>
+  { using type = std::basic_string<C>; };
+  template <typename C>
+  struct deferred_type<
+    C*, std::enable_if_t<is_text_char<std::remove_cv_t<C>>::value>>
+  { using type = std::basic_string<std::remove_cv_t<C>>; };
+  template <typename T, std::size_t N>
+  struct deferred_type<T[N], std::enable_if_t<!is_text_char<T>::value>>
+  { using type = std::array<T, N>; };
+
+  template <typename T>
+  using deferred_type_t =
+    typename deferred_type<std::remove_cv_t<std::remove_reference_t<T>>>::type;
+
+  template <typename T, std::size_t N, std::size_t... Is>
+  inline std::array<std::remove_cv_t<T>, N> deferred_array(
+      T (&a)[N], std::index_sequence<Is...>)
+  {
+    return {{ a[Is]... }};
+  }
+
+  template <typename T, std::size_t N>
+  inline std::enable_if_t<!is_text_char<std::remove_cv_t<T>>::value,
+                          std::array<std::remove_cv_t<T>, N>>
+  deferred_capture(T (&a)[N])
+  {
+    return deferred_array(a, std::make_index_sequence<N>{});
+  }
+
+  template <typename C, std::size_t N>
+  inline std::enable_if_t<is_text_char<std::remove_cv_t<C>>::value,
+                          std::basic_string<std::remove_cv_t<C>>>
+  deferred_capture(C (&a)[N])
+  {
+    return std::basic_string<std::remove_cv_t<C>>(
+      a, std::find(a, a + N, C{}));
+  }
+
+  // A C string pointer is told apart here rather than by overloading, since
+  // an overload taking a pointer would be as good a match for an array.
+  template <typename T>
+  inline T&& deferred_capture(T&& t, std::false_type)
+  {
+    return std::forward<T>(t);
+  }
+
+  template <typename C>
+  inline std::basic_string<std::remove_cv_t<C>> deferred_capture(
+      C* p, std::true_type)
+  {
+    return p ? std::basic_string<std::remove_cv_t<C>>(p)
+      : std::basic_string<std::remove_cv_t<C>>();
+  }
+
+  template <typename T>
+  inline decltype(auto) deferred_capture(T&& t)
+  {
+    using P = std::remove_cv_t<std::remove_reference_t<T>>;
+    return deferred_capture(
+      std::forward<T>(t),
+      std::integral_constant<
+        bool, std::is_pointer<P>::value
+        && is_text_char<std::remove_cv_t<std::remove_pointer_t<P>>>::value>{});
+  }
+
+  template <typename T, typename F>
+  struct deferred_value
+  {
+    T t;
+    F f;
+  };
+
+  struct deferred_ops
+  {
+    void (*to_buffer)(const void*, buffer_sink&);
+    void (*to_ostream)(const void*, ostream_sink&);
+    // construct dst from src and destroy src
+    void (*move)(void* dst, void* src) noexcept;
+    void (*destroy)(void*) noexcept;
+  };
+
+  // Held in the record's own storage.
+  template <typename V>
+  struct deferred_inline
+  {
+    template <typename S>
+    static void output(const void* p, S& s)
+    {
+      const V& v = *static_cast<const V*>(p);
+      prettyprint_to(s, v.t, v.f);
+    }
+
+    static void move(void* dst, void* src) noexcept
+    {
+      V* v = static_cast<V*>(src);
+      ::new (dst) V(std::move(*v));
+      v->~V();
+    }
+
+    static void destroy(void* p) noexcept { static_cast<V*>(p)->~V(); }
+
+    static constexpr deferred_ops ops = {
+      &output<buffer_sink>, &output<ostream_sink>, &move, &destroy };
+  };
+
+  template <typename V>
+  constexpr deferred_ops deferred_inline<V>::ops;
+
+  // Too big (or not nothrow movable): held on the heap, with the record's
+  // storage holding the pointer.
+  template <typename V>
+  struct deferred_heap
+  {
+    template <typename S>
+    static void output(const void* p, S& s)
+    {
+      deferred_inline<V>::output(*static_cast<V* const*>(p), s);
+    }
+
+    static void move(void* dst, void* src) noexcept
+    {
+      ::new (dst) V*(*static_cast<V**>(src));
+    }
+
+    static void destroy(void* p) noexcept { delete *static_cast<V**>(p); }
+
+    static constexpr deferred_ops ops = {
+      &output<buffer_sink>, &output<ostream_sink>, &move, &destroy };
+  };
+
+  template <typename V>
+  constexpr deferred_ops deferred_heap<V>::ops;
+
+  template <typename V>
+  struct deferred_tag {};
+} // detail
+
+class deferred_output
+{
+public:
+  static constexpr std::size_t inline_size = 64 - sizeof(void*);
+
+  template <typename V, typename... Args>
+  deferred_output(detail::deferred_tag<V>, Args&&... args)
+  {
+    construct<V>(std::integral_constant<bool, is_inline<V>()>{},
+                 std::forward<Args>(args)...);
+  }
+
+  deferred_output(deferred_output&& d) noexcept
+    : m_ops(d.m_ops)
+  {
+    if (m_ops)
+      m_ops->move(&m_storage, &d.m_storage);
+    d.m_ops = nullptr;
+  }
+
+  deferred_output& operator=(deferred_output&& d) noexcept
+  {
+    if (this != &d)
+    {
+      reset();
+      if (d.m_ops)
+        d.m_ops->move(&m_storage, &d.m_storage);
+      m_ops = d.m_ops;
+      d.m_ops = nullptr;
+    }
+    return *this;
+  }
+
+  deferred_output(const deferred_output&) = delete;
+  deferred_output& operator=(const deferred_output&) = delete;
+
+  ~deferred_output() { reset(); }
+
+  // A moved-from record outputs nothing.
+  explicit operator bool() const { return m_ops != nullptr; }
+
+  buffer_sink& output(buffer_sink& s) const
+  {
+    if (m_ops)
+      m_ops->to_buffer(&m_storage, s);
+    return s;
+  }
+
+  ostream_sink& output(ostream_sink& s) const
+  {
+    if (m_ops)
+      m_ops->to_ostream(&m_storage, s);
+    return s;
+  }
+
+  std::string str() const
+  {
+    buffer_sink s;
+    return output(s).release();
+  }
+
+private:
+  template <typename V>
+  static constexpr bool is_inline()
+  {
+    return sizeof(V) <= inline_size
+      && alignof(V) <= alignof(std::max_align_t)
+      && std::is_nothrow_move_constructible<V>::value;
+  }
+
+  template <typename V, typename... Args>
+  void construct(std::true_type, Args&&... args)
+  {
+    ::new (&m_storage) V{std::forward<Args>(args)...};
+    m_ops = &detail::deferred_inline<V>::ops;
+  }
+
+  template <typename V, typename... Args>
+  void construct(std::false_type, Args&&... args)
+  {
+    ::new (&m_storage) V*(new V{std::forward<Args>(args)...});
+    m_ops = &detail::deferred_heap<V>::ops;
+  }
+
+  void reset()
+  {
+    if (m_ops)
+      m_ops->destroy(&m_storage);
+    m_ops = nullptr;
+  }
+
+  alignas(std::max_align_t) unsigned char m_storage[inline_size];
+  const detail::deferred_ops* m_ops = nullptr;
+};
+
+inline std::ostream& operator<<(std::ostream& s, const deferred_output& d)
+{
+  return detail::output_padded(
+      s, [&d] (ostream_sink& sink) { d.output(sink); });
+}
+
+template <typename T>
+inline deferred_output prettyprint_deferred(T&& t)
+{
+  using V = detail::deferred_value<detail::deferred_type_t<T>,
+                                   default_formatter>;
+  return deferred_output(detail::deferred_tag<V>{},
+                         detail::deferred_capture(std::forward<T>(t)),
+                         default_formatter{});
+}
+
+template <typename T, typename F>
+inline deferred_output prettyprint_deferred(T&& t, F&& f)
+{
+  using V = detail::deferred_value<detail::deferred_type_t<T>,
+                                   std::decay_t<F>>;
+  return deferred_output(detail::deferred_tag<V>{},
+                         detail::deferred_capture(std::forward<T>(t)),
+                         std::forward<F>(f));
+}
+
+// -----------------------------------------------------------------------------
+// Default: not stringifiable
+template <typename T, typename F, typename TAG>
+struct stringifier_select
+{
+  explicit stringifier_select(const T&, const F&) {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    detail::emit(s, "<unknown>");
+    return s;
+  }
+};
+
+// -----------------------------------------------------------------------------
+// Following pointers, for formatters with follow_pointers()
+namespace detail
+{
+  // distinguishes objects at the same address (like a struct and its first
+  // member)
+  template <typename T>
+  struct type_key { static const char id; };
+  template <typename T>
+  const char type_key<T>::id = 0;
+
+  SFINAE_DETECT(complete_type, std::declval<T&>())
+
+  // Pointers to characters are strings, not followed.
+  template <typename T>
+  using is_followable = std::integral_constant<
+    bool,
+    !std::is_void<T>::value && !std::is_function<T>::value
+    && !std::is_same<T, char>::value && !std::is_same<T, signed char>::value
+    && !std::is_same<T, unsigned char>::value
+    && !is_wide_char<T>::value && has_complete_type<T>::value>;
+
+  template <typename T>
+  struct is_pointer_like : public std::false_type {};
+  template <typename T>
+  struct is_pointer_like<T*> : public is_followable<std::remove_cv_t<T>> {};
+  template <typename T, typename D>
+  struct is_pointer_like<std::unique_ptr<T, D>>
+    : public is_followable<std::remove_cv_t<T>> {};
+  template <typename T>
+  struct is_pointer_like<std::shared_ptr<T>>
+    : public is_followable<std::remove_cv_t<T>> {};
+
+  template <typename T>
+  struct is_optional : public std::false_type {};
+#if defined(PRETTYPRINT_HAS_OPTIONAL)
+  template <typename T>
+  struct is_optional<std::optional<T>> : public std::true_type {};
+#endif
+
+  // Returns whether the value was output by following it.
+  template <typename S, typename T, typename F>
+  inline std::enable_if_t<!is_pointer_like<T>::value && !is_optional<T>::value,
+                          bool>
+  follow(S&, const T&, const F&)
+  {
+    return false;
+  }
+
+  template <typename S, typename P, typename F>
+  inline std::enable_if_t<is_pointer_like<P>::value, bool>
+  follow(S& s, const P& p, const F& f)
+  {
+    if (!follow_pointers(f))
+      return false;
+    if (!p)
+    {
+      emit(s, null_literal(f));
+      return true;
+    }
+
+    const auto& t = *p;
+    using T = std::remove_cv_t<std::remove_reference_t<decltype(t)>>;
+    const auto id = current_output().visited->insert(
+        static_cast<const void*>(std::addressof(t)), &type_key<T>::id);
+    emit(s, '#');
+    output_integer(s, id.first);
+    if (id.second)
+      return true;
+
+    emit(s, '=');
+    depth_guard depth;
+    if (current_output().depth > max_depth(f))
+      emit(s, "...");
+    else
+      output_nested(s, t, f);
+    return true;
+  }
+
+  template <typename S, typename T, typename F>
+  inline std::enable_if_t<is_optional<T>::value, bool>
+  follow(S& s, const T& t, const F& f)
+  {
+    if (!follow_pointers(f))
+      return false;
+    if (t)
+      output_nested(s, *t, f);
+    else
+      emit(s, null_literal(f));
+    return true;
+  }
+} // detail
+
+// -----------------------------------------------------------------------------
+// Specialization for outputtable
+template <typename T, typename F>
+struct stringifier_select<T, F, detail::is_outputtable_tag>
+{
+  explicit stringifier_select(const T& t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    if (!detail::follow(s, m_t, m_f))
+      detail::output_formatted(s, m_t, m_f);
+    return s;
+  }
+
+  const T& m_t;
+  const F& m_f;
+};
+
+// -----------------------------------------------------------------------------
+// Specialize for string
+template <typename C, typename T, typename A, typename F>
+struct stringifier_select<std::basic_string<C,T,A>, F, detail::is_outputtable_tag>
+{
+  using S = std::basic_string<C,T,A>;
+  explicit stringifier_select(const S& t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  template <typename Sink>
+  Sink& output(Sink& s) const
+  {
+    detail::emit(s, detail::opener(m_f, m_t));
+    detail::output_string(s, m_t.data(), m_t.size(), m_f);
+    detail::emit(s, detail::closer(m_f, m_t));
+    return s;
+  }
+
+  const S& m_t;
+  const F& m_f;
+};
+
+template <typename C, typename T, typename A, typename F>
+struct stringifier_select<const std::basic_string<C,T,A>, F, detail::is_outputtable_tag>
+  : public stringifier_select<std::basic_string<C,T,A>, F, detail::is_outputtable_tag>
+{
+  using S = std::basic_string<C,T,A>;
+  explicit stringifier_select(const S& t, const F& f)
+    : stringifier_select<std::basic_string<C,T,A>, F, detail::is_outputtable_tag>(t, f)
+  {}
+};
+
+// -----------------------------------------------------------------------------
+// Specialize for char* pointer-to-const and const-pointer varieties
+template <typename F>
+struct stringifier_select<char*, F, detail::is_outputtable_tag>
+{
+  explicit stringifier_select(const char* const t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    detail::emit(s, detail::opener(m_f, m_t));
+    detail::output_string(s, m_t, std::strlen(m_t), m_f);
+    detail::emit(s, detail::closer(m_f, m_t));
+    return s;
+  }
+
+  const char* const m_t;
+  const F& m_f;
+};
+
+template <typename F>
+struct stringifier_select<char* const, F, detail::is_outputtable_tag>
+  : public stringifier_select<char*, F, detail::is_outputtable_tag>
+{
+  explicit stringifier_select(char* const t, const F& f)
+    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
+  {}
+};
+
+template <typename F>
+struct stringifier_select<const char*, F, detail::is_outputtable_tag>
+  : public stringifier_select<char*, F, detail::is_outputtable_tag>
+{
+  explicit stringifier_select(const char* t, const F& f)
+    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
+  {}
+};
+
+template <typename F>
+struct stringifier_select<const char* const, F, detail::is_outputtable_tag>
+  : public stringifier_select<char*, F, detail::is_outputtable_tag>
+{
+  explicit stringifier_select(const char* const t, const F& f)
+    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
+  {}
+};
+
+// -----------------------------------------------------------------------------
+// Specialize for const char[] and char[]
+template <size_t N, typename F>
+struct stringifier_select<char[N], F, detail::is_outputtable_tag>
+  : public stringifier_select<char*, F, detail::is_outputtable_tag>
+{
+  using S = char[N];
+  explicit stringifier_select(const S& t, const F& f)
+    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
+  {}
+};
+
+template <size_t N, typename F>
+struct stringifier_select<const char[N], F, detail::is_outputtable_tag>
+  : public stringifier_select<char*, F, detail::is_outputtable_tag>
+{
+  using S = char[N];
+  explicit stringifier_select(const S& t, const F& f)
+    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
+  {}
+};
+
+template <typename F>
+struct stringifier_select<char[], F, detail::is_outputtable_tag>
+  : public stringifier_select<char*, F, detail::is_outputtable_tag>
+{
+  explicit stringifier_select(char t[], const F& f)
+    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
+  {}
+};
+
+template <typename F>
+struct stringifier_select<const char[], F, detail::is_outputtable_tag>
+  : public stringifier_select<char*, F, detail::is_outputtable_tag>
+{
+  explicit stringifier_select(const char t[], const F& f)
+    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
+  {}
+};
+
+// -----------------------------------------------------------------------------
+// Specialization for wide characters and strings (of any kind), which are
+// converted to UTF-8
+template <typename T, typename F>
+struct stringifier_select<T, F, detail::is_wide_string_tag>
+{
+  explicit stringifier_select(const T& t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    detail::output_wide(s, m_t, m_f,
+                        detail::is_wide_quoted<std::remove_cv_t<T>>{});
+    return s;
+  }
+
+  const T& m_t;
+  const F& m_f;
+};
+
+// -----------------------------------------------------------------------------
+// Specialize for arrays
+namespace detail
+{
+  // When output is cut short, say how much was left out if we know without
+  // walking the rest.
+  template <typename S, typename T>
+  inline std::enable_if_t<has_member_size<T>::value>
+  output_elision(S& s, const T& t, std::size_t n)
+  {
+    emit(s, "...(+");
+    output_integer(s, static_cast<std::size_t>(t.size()) - n);
+    emit(s, " more)");
+  }
+
+  template <typename S, typename T, std::size_t N>
+  inline void output_elision(S& s, const T(&)[N], std::size_t n)
+  {
+    emit(s, "...(+");
+    output_integer(s, N - n);
+    emit(s, " more)");
+  }
+
+  template <typename S, typename T>
+  inline std::enable_if_t<!has_member_size<T>::value>
+  output_elision(S& s, const T&, std::size_t)
+  {
+    emit(s, "...");
+  }
+
+  template <typename S, typename F>
+  inline bool over_budget(const S& s, const F& f)
+  {
+    return max_bytes(f) != std::numeric_limits<std::size_t>::max()
+      && sink_size(s) - current_output().start >= max_bytes(f);
+  }
+
+  // A range is iterated through a const reference unless it (or a range
+  // nested in it) needs to be non-const, and the object is. A const range
+  // that needs to be non-const isn't classified as a range at all (see
+  // iterable_constness).
+  template <typename T, bool = has_begin<const T>::value>
+  struct iterates_non_const : public needs_non_const<T> {};
+  template <typename T>
+  struct iterates_non_const<T, true>
+  {
+    using E = std::remove_cv_t<std::remove_reference_t<
+      decltype(*std::begin(std::declval<const T&>()))>>;
+    // (some ranges, like filesystem paths, have elements of their own type)
+    static constexpr bool value =
+      !std::is_same<E, T>::value && iterates_non_const<E>::value;
+  };
+
+  template <typename T>
+  using iterate_non_const = std::integral_constant<
+    bool, !std::is_const<T>::value && iterates_non_const<T>::value>;
+
+  template <typename T>
+  inline std::enable_if_t<!iterate_non_const<T>::value, const T&>
+  iterable_ref(T& t) { return t; }
+
+  template <typename T>
+  inline std::enable_if_t<iterate_non_const<T>::value, T&>
+  iterable_ref(T& t) { return t; }
+
+  // Output elements [b, e) of container t with out(s, element), separated and
+  // cut short according to the formatter. The end may be a sentinel of a
+  // different type, and the range is only walked once, so that input ranges
+  // are output as they are produced.
+  template <typename S, typename T, typename It, typename End, typename F,
+            typename Out>
+  inline void output_elements(S& s, const T& t, It b, End e, const F& f,
+                              Out out)
+  {
+    const auto sep = hoist(separator(f, t));
+    const std::size_t max_n = max_elements(f);
+    for (std::size_t n = 0; ; ++n)
+    {
+      if (n >= max_n || over_budget(s, f))
+      {
+        output_elision(s, t, n);
+        break;
+      }
+      out(s, *b);
+      if (++b == e)
+        break;
+      emit(s, sep);
+      line_break(s);
+    }
+  }
+
+  // Only unordered containers whose keys have operator< can be sorted; the
+  // rest are output in hash order even with sort_unordered. Entries of a map
+  // are sorted by key and then by value, when values have operator< too;
+  // otherwise (and for equivalent elements of a multiset) the order of
+  // entries with equal keys is still the hash order. A container's or
+  // pair's operator< is declared whether or not its elements have one, so
+  // those are looked into.
+  SFINAE_DETECT(less, std::declval<const T&>() < std::declval<const T&>())
+  SFINAE_DETECT(value_type, std::declval<typename T::value_type*>())
+
+  template <typename T, bool = has_value_type<T>::value>
+  struct is_less_comparable : public has_less<T> {};
+  template <typename T>
+  struct is_less_comparable<T, true>
+    : public std::integral_constant<
+        bool, has_less<T>::value
+        && (std::is_same<typename T::value_type, T>::value
+            || is_less_comparable<typename T::value_type>::value)> {};
+  template <typename T, typename U>
+  struct is_less_comparable<std::pair<T, U>, false>
+    : public std::integral_constant<
+        bool, is_less_comparable<std::remove_cv_t<T>>::value
+        && is_less_comparable<std::remove_cv_t<U>>::value> {};
+  template <typename... Ts>
+  struct is_less_comparable<std::tuple<Ts...>, false>
+    : public std::is_same<
+        std::integer_sequence<bool, true, is_less_comparable<Ts>::value...>,
+        std::integer_sequence<bool, is_less_comparable<Ts>::value..., true>> {};
+
+  template <typename T, bool = has_hasher<T>::value>
+  struct is_sortable : public std::false_type {};
+  template <typename T>
+  struct is_sortable<T, true>
+    : public is_less_comparable<typename T::key_type> {};
+
+  template <typename T, bool = has_mapped_type<T>::value>
+  struct sorts_by_key : public std::false_type {};
+  template <typename T>
+  struct sorts_by_key<T, true>
+    : public std::integral_constant<
+        bool, !is_less_comparable<typename T::mapped_type>::value> {};
+
+  template <typename T>
+  constexpr const T& sort_key(const T& e, std::false_type) { return e; }
+
+  template <typename T>
+  constexpr const auto& sort_key(const T& e, std::true_type) { return e.first; }
+
+  // Sorting an unordered container sorts pointers to its elements. When only
+  // the first max_elements will be output, only the smallest of those (plus
+  // one, so that the elision is still output) are kept, in a heap.
+  template <typename S, typename T, typename It, typename End, typename F,
+            typename Out>
+  inline void output_elements(S& s, const T& t, It b, End e, const F& f,
+                              Out out, std::true_type)
+  {
+    if (!sort_unordered(f))
+      return output_elements(s, t, std::move(b), std::move(e), f, out);
+
+    using V = typename T::value_type;
+    auto less = [] (const V* x, const V* y)
+      { return sort_key(*x, sorts_by_key<T>{})
+          < sort_key(*y, sorts_by_key<T>{}); };
+
+    const std::size_t max_n = max_elements(f);
+    const std::size_t size = t.size();
+    const std::size_t keep = max_n < size ? max_n + 1 : size;
+
+    std::vector<const V*, scratch_allocator<const V*>> v;
+    v.reserve(keep);
+    for (const auto& elem : t)
+    {
+      if (v.size() < keep)
+      {
+        v.push_back(&elem);
+        if (v.size() == keep && keep < size)
+          std::make_heap(v.begin(), v.end(), less);
+      }
+      else if (less(&elem, v.front()))
+      {
+        std::pop_heap(v.begin(), v.end(), less);
+        v.back() = &elem;
+        std::push_heap(v.begin(), v.end(), less);
+      }
+    }
+    if (keep < size)
+      std::sort_heap(v.begin(), v.end(), less);
+    else
+      std::sort(v.begin(), v.end(), less);
+
+    output_elements(s, t, v.begin(), v.end(), f,
+                    [&out] (S& sink, const V* elem) { out(sink, *elem); });
+  }
+
+  template <typename T>
+  struct is_contiguous : public std::false_type {};
+  template <typename T, typename A>
+  struct is_contiguous<std::vector<T, A>> : public std::true_type {};
+  template <typename A>
+  struct is_contiguous<std::vector<bool, A>> : public std::false_type {};
+  template <typename T, std::size_t N>
+  struct is_contiguous<std::array<T, N>> : public std::true_type {};
+  template <typename T, std::size_t N>
+  struct is_contiguous<T[N]> : public std::true_type {};
+
+  // Integers, chars and bools in a vector or array are output in bulk: their
+  // output doesn't depend on the formatter (except that chars are quoted with
+  // quote_values), so they are written straight into a local buffer along
+  // with the separator, and the buffer handed to the sink as it fills.
+  template <typename T>
+  using is_bulk_char = std::integral_constant<
+    bool, std::is_same<T, char>::value || std::is_same<T, signed char>::value
+    || std::is_same<T, unsigned char>::value>;
+
+  template <typename T>
+  using is_bulk_formatted = std::integral_constant<
+    bool, is_formatted_integer<T>::value || std::is_same<T, bool>::value
+    || is_bulk_char<T>::value>;
+
+  template <typename T>
+  using element_t =
+    std::remove_cv_t<std::remove_reference_t<decltype(*std::begin(std::declval<const T&>()))>>;
+
+  template <typename E, typename S, typename F>
+  inline bool bulk_output_allowed(const S& s, const F& f)
+  {
+    return is_bulk_formatted<E>::value && default_format(s)
+      && !has_begin_group<S>::value
+      && (!is_bulk_char<E>::value || !quote_values(f));
+  }
+
+  template <typename U>
+  inline std::size_t count_digits(U u)
+  {
+    std::size_t n = 1;
+    for (;;)
+    {
+      if (u < 10) return n;
+      if (u < 100) return n + 1;
+      if (u < 1000) return n + 2;
+      if (u < 10000) return n + 3;
+      u = static_cast<U>(u / 10000);
+      n += 4;
+    }
+  }
+
+  template <typename T>
+  inline std::enable_if_t<is_formatted_integer<T>::value, char*>
+  format_bulk(char* p, T t)
+  {
+    using U = std::make_unsigned_t<T>;
+    U u = static_cast<U>(t);
+    if (t < 0)
+    {
+      *p++ = '-';
+      u = static_cast<U>(U(0) - u);
+    }
+    char* last = p + count_digits(u);
+    format_decimal(last, u);
+    return last;
+  }
+
+  template <typename T>
+  inline std::enable_if_t<is_bulk_char<T>::value, char*>
+  format_bulk(char* p, T t)
+  {
+    *p = static_cast<char>(t);
+    return p + 1;
+  }
+
+  inline char* format_bulk(char* p, bool t)
+  {
+    if (t)
+    {
+      std::memcpy(p, "true", 4);
+      return p + 4;
+    }
+    std::memcpy(p, "false", 5);
+    return p + 5;
+  }
+
+  // The widest output of one element.
+  template <typename T>
+  constexpr std::size_t bulk_width()
+  {
+    return std::numeric_limits<T>::digits10 + 3 < 5
+      ? 5 : std::numeric_limits<T>::digits10 + 3;
+  }
+
+  template <typename S>
+  class bulk_writer
+  {
+  public:
+    static constexpr std::size_t capacity = 4096;
+
+    bulk_writer(S& s, format_literal sep)
+      : m_s(s)
+      , m_sep(sep)
+    {}
+    bulk_writer(const bulk_writer&) = delete;
+    bulk_writer& operator=(const bulk_writer&) = delete;
+    ~bulk_writer() { flush(); }
+
+    template <typename T>
+    void first(T t)
+    {
+      m_p = format_bulk(m_p, t);
+    }
+
+    // A single-char separator (the usual case) is one store.
+    template <typename T>
+    void next(T t)
+    {
+      if (m_p + bulk_width<T>() + m_sep.size() > m_buf + capacity)
+        flush();
+      if (m_sep.size() == 1)
+      {
+        *m_p++ = *m_sep.data();
+      }
+      else if (m_sep.size() > capacity / 2)
+      {
+        flush();
+        m_s.write(m_sep.data(), m_sep.size());
+      }
+      else
+      {
+        std::memcpy(m_p, m_sep.data(), m_sep.size());
+        m_p += m_sep.size();
+      }
+      m_p = format_bulk(m_p, t);
+    }
+
+    void flush()
+    {
+      if (m_p != m_buf)
+        m_s.write(m_buf, static_cast<std::size_t>(m_p - m_buf));
+      m_p = m_buf;
+    }
+
+  private:
+    S& m_s;
+    format_literal m_sep;
+    char m_buf[capacity];
+    char* m_p = m_buf;
+  };
+
+  template <typename S, typename E>
+  inline void output_bulk(S& s, const E* b, const E* e, format_literal sep)
+  {
+    bulk_writer<S> w(s, sep);
+    w.first(*b);
+    while (++b != e)
+      w.next(*b);
+  }
+
+  // Output a run [b, e) of a vector or array, in bulk if we can.
+  template <typename S, typename It, typename Sep, typename Out>
+  inline void output_run(S& s, It b, It e, const Sep& sep, Out out, bool bulk,
+                         std::true_type)
+  {
+    if (bulk)
+      return output_bulk(s, &*b, &*b + (e - b), as_literal(sep));
+    output_run(s, b, e, sep, out, false, std::false_type{});
+  }
+
+  template <typename S, typename It, typename Sep, typename Out>
+  inline void output_run(S& s, It b, It e, const Sep& sep, Out out, bool,
+                         std::false_type)
+  {
+    out(s, *b);
+    while (++b != e)
+    {
+      emit(s, sep);
+      out(s, *b);
+    }
+  }
+
+  // Elided output of a bulk container: what the element-by-element loop
+  // would give.
+  template <typename S, typename T, typename F, typename Sep, typename Run>
+  inline void output_bulk_limited(S& s, const T& t, std::size_t size,
+                                  const F& f, const Sep& sep, Run run)
+  {
+    const std::size_t n = std::min(size, max_elements(f));
+    if (n > 0)
+      run(n);
+    if (n < size)
+    {
+      if (n > 0)
+        emit(s, sep);
+      output_elision(s, t, n);
+    }
+  }
+
+  // A large enough vector or array can be split into chunks, one per thread,
+  // each formatted into its own buffer and then output in order. The first
+  // chunk is formatted by the caller. Only done without limits on elements or
+  // bytes (which depend on what went before), or stats (which are per
+  // thread), and when the sink formats numbers the same way a buffer does;
+  // and only for the outermost such container, so that the threads used are
+  // bounded by max_threads() however the containers nest.
+  template <typename S, typename T, typename F, typename Out>
+  inline bool output_parallel(S& s, const T& t, const F& f, Out out)
+  {
+#if !defined(PRETTYPRINT_NO_THREADS)
+    constexpr std::size_t min_chunk = 4096;
+    constexpr std::size_t unlimited = std::numeric_limits<std::size_t>::max();
+    const std::size_t n =
+      static_cast<std::size_t>(std::end(t) - std::begin(t));
+    const std::size_t threads = max_threads(f);
+    if (threads < 2 || n < 2 * min_chunk || current_output().parallel
+        || !default_format(s)
+        || has_begin_group<S>::value || follow_pointers(f)
+        || has_report_stats<F>::value
+        || max_elements(f) != unlimited || max_bytes(f) != unlimited)
+      return false;
+
+    const std::size_t chunks = std::min(threads, n / min_chunk);
+    const auto sep = hoist(separator(f, t));
+    const auto first = std::begin(t);
+    const std::size_t depth = current_output().depth;
+    using E = element_t<T>;
+    const bool bulk = bulk_output_allowed<E>(s, f);
+    auto output_chunk = [&] (auto& sink, std::size_t i) {
+      const auto b = first + static_cast<std::ptrdiff_t>(i * n / chunks);
+      const auto e = first + static_cast<std::ptrdiff_t>((i + 1) * n / chunks);
+      output_run(sink, b, e, sep, out, bulk, is_bulk_formatted<E>{});
+    };
+
+    std::vector<std::future<std::string>> rest;
+    rest.reserve(chunks - 1);
+    for (std::size_t i = 1; i < chunks; ++i)
+    {
+      rest.push_back(std::async(std::launch::async, [&, i] {
+            current_output().depth = depth;
+            current_output().parallel = true;
+            buffer_sink b;
+            output_chunk(b, i);
+            return b.release();
+          }));
+    }
+    struct parallel_scope
+    {
+      parallel_scope() { current_output().parallel = true; }
+      ~parallel_scope() { current_output().parallel = false; }
+    } scope;
+    output_chunk(s, 0);
+    for (auto& r : rest)
+    {
+      emit(s, sep);
+      const std::string chunk = r.get();
+      s.write(chunk.data(), chunk.size());
+    }
+    return true;
+#else
+    (void)s; (void)t; (void)f; (void)out;
+    return false;
+#endif
+  }
+
+  template <typename S, typename T, typename It, typename End, typename F,
+            typename Out>
+  inline void output_contiguous(S& s, const T& t, It b, End e, const F& f,
+                                Out out, std::true_type)
+  {
+    if (output_parallel(s, t, f, out))
+      return;
+    using E = element_t<T>;
+    if (bulk_output_allowed<E>(s, f)
+        && max_bytes(f) == std::numeric_limits<std::size_t>::max())
+    {
+      const auto sep = hoist(separator(f, t));
+      const E* first = &*b;
+      output_bulk_limited(
+          s, t, static_cast<std::size_t>(e - b), f, sep,
+          [&] (std::size_t n) {
+            output_run(s, first, first + n, sep, out, true,
+                       is_bulk_formatted<E>{});
+            count_elements(f, n);
+          });
+      return;
+    }
+    output_elements(s, t, std::move(b), std::move(e), f, out);
+  }
+
+  // vector<bool>'s storage isn't reachable portably, so it is walked with its
+  // iterators, but written in bulk.
+  template <typename S, typename A>
+  inline void output_bits(S& s, const std::vector<bool, A>& t, std::size_t n,
+                          format_literal sep)
+  {
+    bulk_writer<S> w(s, sep);
+    auto b = t.begin();
+    w.first(static_cast<bool>(*b));
+    for (std::size_t i = 1; i < n; ++i)
+      w.next(static_cast<bool>(*++b));
+  }
+
+  template <typename S, typename A, typename It, typename End, typename F,
+            typename Out>
+  inline void output_contiguous(S& s, const std::vector<bool, A>& t, It b,
+                                End e, const F& f, Out out, std::false_type)
+  {
+    if (!bulk_output_allowed<bool>(s, f)
+        || max_bytes(f) != std::numeric_limits<std::size_t>::max())
+      return output_elements(s, t, std::move(b), std::move(e), f, out);
+    const auto sep = hoist(separator(f, t));
+    output_bulk_limited(s, t, t.size(), f, sep, [&] (std::size_t n) {
+        output_bits(s, t, n, as_literal(sep));
+        count_elements(f, n);
+      });
+  }
+
+  template <typename S, typename T, typename It, typename End, typename F,
+            typename Out>
+  inline void output_contiguous(S& s, const T& t, It b, End e, const F& f,
+                                Out out, std::false_type)
+  {
+    output_elements(s, t, std::move(b), std::move(e), f, out);
+  }
+
+  template <typename S, typename T, typename It, typename End, typename F,
+            typename Out>
+  inline void output_elements(S& s, const T& t, It b, End e, const F& f,
+                              Out out, std::false_type)
+  {
+    output_contiguous(s, t, std::move(b), std::move(e), f, out,
+                      is_contiguous<T>{});
+  }
+
+  // ---------------------------------------------------------------------------
+  // Byte containers as hex, hex dumps or base64. Bytes are encoded a chunk at
+  // a time into a local buffer, hex a vector at a time. Only max_elements
+  // applies: it limits the number of bytes encoded.
+  template <typename T>
+  struct is_byte : public std::is_same<T, unsigned char> {};
+#ifdef __cpp_lib_byte
+  template <>
+  struct is_byte<std::byte> : public std::true_type {};
+#endif
+
+  template <typename T, bool = is_contiguous<T>::value>
+  struct is_byte_container : public std::false_type {};
+  template <typename T>
+  struct is_byte_container<T, true> : public is_byte<element_t<T>> {};
+
+  template <typename T>
+  inline const unsigned char* byte_data(const T& t)
+  {
+    return reinterpret_cast<const unsigned char*>(t.data());
+  }
+
+  template <typename T, std::size_t N>
+  inline const unsigned char* byte_data(const T (&t)[N])
+  {
+    return reinterpret_cast<const unsigned char*>(t);
+  }
+
+  constexpr char lower_hex_digits[] = "0123456789abcdef";
+
+  // Write 2n hex digits for p[0..n) to out.
+  inline char* encode_hex(char* out, const unsigned char* p, std::size_t n)
+  {
+#if defined(PRETTYPRINT_AVX2)
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i alpha = _mm256_set1_epi8('a' - '0' - 10);
+    auto digits = [&] (__m256i x) {
+      return _mm256_add_epi8(
+          _mm256_add_epi8(x, zero),
+          _mm256_and_si256(_mm256_cmpgt_epi8(x, nine), alpha));
+    };
+    for (; n >= 32; n -= 32, p += 32, out += 64)
+    {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      const __m256i hi = digits(_mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+      const __m256i lo = digits(_mm256_and_si256(v, mask));
+      // unpacking interleaves within each 128-bit lane
+      const __m256i a = _mm256_unpacklo_epi8(hi, lo);
+      const __m256i b = _mm256_unpackhi_epi8(hi, lo);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out),
+                          _mm256_permute2x128_si256(a, b, 0x20));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32),
+                          _mm256_permute2x128_si256(a, b, 0x31));
+    }
+#elif defined(PRETTYPRINT_SSE2)
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+    auto digits = [&] (__m128i x) {
+      return _mm_add_epi8(_mm_add_epi8(x, zero),
+                          _mm_and_si128(_mm_cmpgt_epi8(x, nine), alpha));
+    };
+    for (; n >= 16; n -= 16, p += 16, out += 32)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const __m128i hi = digits(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+      const __m128i lo = digits(_mm_and_si128(v, mask));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                       _mm_unpacklo_epi8(hi, lo));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16),
+                       _mm_unpackhi_epi8(hi, lo));
+    }
+#elif defined(PRETTYPRINT_NEON)
+    const uint8x16_t table =
+      vld1q_u8(reinterpret_cast<const uint8_t*>(lower_hex_digits));
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    for (; n >= 16; n -= 16, p += 16, out += 32)
+    {
+      const uint8x16_t v = vld1q_u8(p);
+      uint8x16x2_t r;
+      r.val[0] = vqtbl1q_u8(table, vshrq_n_u8(v, 4));
+      r.val[1] = vqtbl1q_u8(table, vandq_u8(v, mask));
+      // the store interleaves
+      vst2q_u8(reinterpret_cast<uint8_t*>(out), r);
+    }
+#endif
+    for (; n > 0; --n, ++p)
+    {
+      *out++ = lower_hex_digits[*p >> 4];
+      *out++ = lower_hex_digits[*p & 0xf];
+    }
+    return out;
+  }
+
+  // Write base64 for p[0..n) to out, padded if n isn't a multiple of 3.
+  inline char* encode_base64(char* out, const unsigned char* p, std::size_t n)
+  {
+    static constexpr char digits[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (; n >= 3; n -= 3, p += 3)
+    {
+      const unsigned v = unsigned{p[0]} << 16 | unsigned{p[1]} << 8 | p[2];
+      out[0] = digits[v >> 18];
+      out[1] = digits[(v >> 12) & 0x3f];
+      out[2] = digits[(v >> 6) & 0x3f];
+      out[3] = digits[v & 0x3f];
+      out += 4;
+    }
+    if (n > 0)
+    {
+      const unsigned v = unsigned{p[0]} << 16 | (n > 1 ? unsigned{p[1]} << 8 : 0);
+      out[0] = digits[v >> 18];
+      out[1] = digits[(v >> 12) & 0x3f];
+      out[2] = n > 1 ? digits[(v >> 6) & 0x3f] : '=';
+      out[3] = '=';
+      out += 4;
+    }
+    return out;
+  }
+
+  // One line of a hex dump: offset, 16 bytes in two groups of 8, and the
+  // bytes again as characters (with a dot for anything not printable).
+  inline char* encode_hexdump_line(char* out, std::size_t offset,
+                                   const unsigned char* p, std::size_t n)
+  {
+    for (int shift = 28; shift >= 0; shift -= 4)
+      *out++ = lower_hex_digits[(offset >> shift) & 0xf];
+    *out++ = ' ';
+    for (std::size_t i = 0; i < 16; ++i)
+    {
+      if (i % 8 == 0)
+        *out++ = ' ';
+      if (i < n)
+      {
+        *out++ = lower_hex_digits[p[i] >> 4];
+        *out++ = lower_hex_digits[p[i] & 0xf];
+      }
+      else
+      {
+        *out++ = ' ';
+        *out++ = ' ';
+      }
+      *out++ = ' ';
+    }
+    *out++ = ' ';
+    *out++ = '|';
+    for (std::size_t i = 0; i < n; ++i)
+      *out++ = p[i] >= 0x20 && p[i] < 0x7f ? static_cast<char>(p[i]) : '.';
+    *out++ = '|';
+    return out;
+  }
+
+  template <typename S, typename F>
+  inline void output_encoded_bytes(S& s, const unsigned char* p,
+                                   std::size_t n, const F& f)
+  {
+    char buf[4096];
+    const char* str = "";
+    const byte_format format = bytes_as(f);
+    if (format == byte_format::hexdump)
+    {
+      constexpr std::size_t line = 16;
+      for (std::size_t i = 0; i < n; i += line)
+      {
+        if (i > 0)
+          s.put('\n');
+        char* out = encode_hexdump_line(buf, i, p + i, std::min(line, n - i));
+        s.write(buf, static_cast<std::size_t>(out - buf));
+      }
+      return;
+    }
+    // a chunk of input (a multiple of 3 for base64) fills the buffer
+    const bool hex = format == byte_format::hex;
+    const std::size_t chunk = hex ? sizeof(buf) / 2 : sizeof(buf) / 4 * 3;
+    emit(s, opener(f, str));
+    for (std::size_t i = 0; i < n; i += chunk)
+    {
+      const std::size_t m = std::min(chunk, n - i);
+      char* out = hex ? encode_hex(buf, p + i, m)
+                      : encode_base64(buf, p + i, m);
+      s.write(buf, static_cast<std::size_t>(out - buf));
+    }
+    emit(s, closer(f, str));
+  }
+
+  template <typename S, typename T, typename F>
+  inline bool output_bytes(S& s, const T& t, const F& f, std::true_type)
+  {
+    if (bytes_as(f) == byte_format::elements)
+      return false;
+    const std::size_t size =
+      static_cast<std::size_t>(std::end(t) - std::begin(t));
+    const std::size_t n = std::min(size, max_elements(f));
+    output_encoded_bytes(s, byte_data(t), n, f);
+    count_elements(f, n);
+    if (n < size)
+      output_elision(s, t, n);
+    return true;
+  }
+
+  template <typename S, typename T, typename F>
+  inline bool output_bytes(S&, const T&, const F&, std::false_type)
+  {
+    return false;
+  }
+
+  // Output a container with out(s, element) for each element, enforcing the
+  // formatter's limits.
+  template <typename S, typename T, typename F, typename Out>
+  inline S& output_range(S& s, T& t, const F& f, Out out)
+  {
+    depth_guard depth;
+    begin_group(s);
+    emit(s, opener(f, t));
+    auto&& r = iterable_ref(t);
+    auto b = std::begin(r);
+    auto e = std::end(r);
+    if (b != e)
+    {
+      if (current_output().depth > max_depth(f))
+      {
+        emit(s, "...");
+      }
+      else
+      {
+        line_break(s);
+        output_elements(s, t, std::move(b), std::move(e), f, out,
+                        is_sortable<std::remove_cv_t<T>>{});
+        line_break(s, true);
+      }
+    }
+    emit(s, closer(f, t));
+    end_group(s);
+    return s;
+  }
+
+  template <typename S, typename T, typename F>
+  inline S& output_iterable(S& s, T& t, const F& f)
+  {
+    if (output_bytes(s, t, f, is_byte_container<std::remove_cv_t<T>>{}))
+      return s;
+    return output_range(s, t, f,
+                        [&f] (auto& sink, auto&& elem)
+                        { output_nested(sink, std::forward<decltype(elem)>(elem), f); });
+  }
+}
+
+template <typename T, size_t N, typename F>
+struct stringifier_select<T[N], F, detail::is_outputtable_tag>
+{
+  using S = T[N];
+  explicit stringifier_select(const S& t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  template <typename Sink>
+  Sink& output(Sink& s) const
+  {
+    return detail::output_iterable(s, m_t, m_f);
+  }
+
+  const S& m_t;
+  const F& m_f;
+};
+
+template <typename T, typename F>
+struct stringifier_select<T[], F, detail::is_outputtable_tag>
+{
+  explicit stringifier_select(T[], const F&)
+  {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    detail::emit(s, "<array (unknown bounds)>");
+    return s;
+  }
+};
+
+// -----------------------------------------------------------------------------
+// Specialize for bool: do boolalpha explicitly so as not to affect stream state
+template <typename F>
+struct stringifier_select<bool, F, detail::is_outputtable_tag>
+{
+  explicit stringifier_select(bool t, const F&)
+    : m_t(t) {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    detail::emit(s, m_t ? "true" : "false");
+    return s;
+  }
+
+  bool m_t;
+};
+
+template <typename F>
+struct stringifier_select<const bool, F, detail::is_outputtable_tag>
+  : public stringifier_select<bool, F, detail::is_outputtable_tag>
+{
+  explicit stringifier_select(bool t, const F& f)
+    : stringifier_select<bool, F, detail::is_outputtable_tag>(t, f)
+  {}
+};
+
+// -----------------------------------------------------------------------------
+// Specialize for iterable, with customization of opener/closer/separator.
+// The range is held with the constness it was given with, since some can
+// only be iterated when non-const.
+template <typename T, typename F>
+struct stringifier_select<T, F, detail::is_iterable_tag>
+{
+  explicit stringifier_select(T& t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  explicit stringifier_select(T&& t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    return detail::output_iterable(s, m_t, m_f);
+  }
+
+  T& m_t;
+  const F& m_f;
+};
+
+namespace detail
+{
+  template <typename S, typename K, typename F>
+  inline void output_key(S& s, const K& k, const F& f);
+} // detail
+
+// -----------------------------------------------------------------------------
+// Specialize for maps: entries are output directly, without going through the
+// pair stringifier, and the entry opener, separator and closer are looked up
+// once per map
+template <typename T, typename F>
+struct stringifier_select<T, F, detail::is_map_tag>
+{
+  explicit stringifier_select(const T& t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    auto b = std::begin(m_t);
+    if (b == std::end(m_t))
+      return detail::output_range(s, m_t, m_f, [] (S&, const auto&) {});
+
+    const F& f = m_f;
+    const auto open = detail::hoist(detail::kv_opener(f, m_t, *b));
+    const auto sep = detail::hoist(detail::kv_separator(f, m_t, *b));
+    const auto close = detail::hoist(detail::kv_closer(f, m_t, *b));
+    return detail::output_range(s, m_t, f,
+                                [&f, open, sep, close] (S& sink, const auto& e)
+                                { detail::emit(sink, open);
+                                  detail::output_key(sink, e.first, f);
+                                  detail::emit(sink, sep);
+                                  detail::output_nested(sink, e.second, f);
+                                  detail::emit(sink, close); });
+  }
+
+  const T& m_t;
+  const F& m_f;
+};
+
+// -----------------------------------------------------------------------------
+// Specialization for callable object
+template <typename T, typename F>
+struct stringifier_select<T, F, detail::is_callable_tag>
+{
+  explicit stringifier_select(const T&, const F& f)
+    : m_f(f)
+  {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    const char* p = "<callable>";
+    const bool quote = detail::quote_values(m_f);
+    if (quote)
+      detail::emit(s, detail::opener(m_f, p));
+    detail::emit(s, "<callable ");
+    detail::emit(s, detail::callable_type<std::remove_cv_t<T>>());
+    detail::emit(s, '>');
+    if (quote)
+      detail::emit(s, detail::closer(m_f, p));
+    return s;
+  }
+
+  const F& m_f;
+};
+
+// -----------------------------------------------------------------------------
+// Specialization for unprintable object
+template <typename T, typename F>
+struct stringifier_select<T, F, detail::is_unprintable_tag>
 {
-  explicit stringifier_select(const char* const t, const F& f)
-    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
+  explicit stringifier_select(const T& t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    if (std::is_null_pointer<T>::value)
+      detail::emit(s, detail::null_literal(m_f));
+    else if (!detail::follow(s, m_t, m_f))
+      detail::output_placeholder(s, detail::unprintable_type<T>(), m_f);
+    return s;
+  }
+
+  const T& m_t;
+  const F& m_f;
+};
+
+// -----------------------------------------------------------------------------
+// Specialization for enum
+namespace detail
+{
+#if defined(__GNUC__)
+#define PRETTYPRINT_HAS_ENUM_NAMES 1
+#endif
+
+  template <typename F, typename = void>
+  struct wants_enum_names : public std::false_type {};
+  template <typename F>
+  struct wants_enum_names<F, std::enable_if_t<F{}.enum_names()>>
+    : public std::true_type {};
+
+#ifdef PRETTYPRINT_HAS_ENUM_NAMES
+  // Names come from the signature of enum_probe<E, V>, which ends with V,
+  // like "... V = ns::E::NAME]". A value with no name shows up as a cast,
+  // like "(ns::E)5". The name is what follows the last "::".
+  inline format_literal enum_probe_name(const char* p, std::size_t n)
+  {
+    const char* end = p + n - 1;
+    const char* b = end;
+    while (b != p && b[-1] != ' ')
+      --b;
+    if (b == end || *b == '(' || *b == '-' || (*b >= '0' && *b <= '9'))
+      return format_literal(nullptr, 0);
+    for (const char* q = b; q != end; ++q)
+    {
+      if (*q == ':')
+        b = q + 1;
+    }
+    return format_literal(b, static_cast<std::size_t>(end - b));
+  }
+
+  template <typename E, E V>
+  inline format_literal enum_probe()
+  {
+    return enum_probe_name(__PRETTY_FUNCTION__,
+                           sizeof(__PRETTY_FUNCTION__) - 1);
+  }
+
+  // Every value of the underlying type can be cast to an enum that is scoped
+  // or has a fixed underlying type; only list-initialization from it tells
+  // the latter apart from any other unscoped enum (and only from C++17).
+  SFINAE_DETECT(default_range, enum_range<T>::is_default)
+  SFINAE_DETECT(list_init, T{std::declval<std::underlying_type_t<T>>()})
+
+  template <typename E>
+  struct has_fixed_type
+    : std::integral_constant<
+        bool, has_list_init<E>::value
+        || !std::is_convertible<E, std::underlying_type_t<E>>::value>
+  {};
+
+  // enum_range, cut down to what the underlying type can hold
+  template <typename E>
+  struct enum_bounds
+  {
+    static_assert(has_fixed_type<E>::value || !has_default_range<E>::value,
+                  "specialize enum_range to output an unscoped enum without "
+                  "a fixed underlying type by name");
+    using U = std::underlying_type_t<E>;
+    using L = std::numeric_limits<U>;
+    static constexpr long long min =
+      static_cast<long long>(L::min()) > enum_range<E>::min
+      ? static_cast<long long>(L::min()) : enum_range<E>::min;
+    static constexpr long long max =
+      L::digits <= 63 && static_cast<long long>(L::max()) < enum_range<E>::max
+      ? static_cast<long long>(L::max()) : enum_range<E>::max;
+  };
+
+  // The names of the values in range, found on first use: each output after
+  // that is a lookup.
+  template <typename E, std::size_t... Is>
+  inline const format_literal* enum_name_table(std::index_sequence<Is...>)
+  {
+    using U = std::underlying_type_t<E>;
+    constexpr long long min = enum_bounds<E>::min;
+    static const format_literal names[] = {
+      enum_probe<E, static_cast<E>(
+                      static_cast<U>(min + static_cast<long long>(Is)))>()...
+    };
+    return names;
+  }
+
+  template <typename E>
+  inline format_literal enum_name(E e)
+  {
+    using U = std::underlying_type_t<E>;
+    using B = enum_bounds<E>;
+    const U u = static_cast<U>(e);
+    if (std::numeric_limits<U>::digits > 63
+        && u > static_cast<U>(std::numeric_limits<long long>::max()))
+      return format_literal(nullptr, 0);
+    const auto v = static_cast<long long>(u);
+    if (v < B::min || v > B::max)
+      return format_literal(nullptr, 0);
+    constexpr auto n = static_cast<std::size_t>(B::max - B::min + 1);
+    return enum_name_table<E>(std::make_index_sequence<n>{})[v - B::min];
+  }
+
+  template <typename S, typename T, typename F>
+  inline void output_enum(S& s, T t, const F& f, std::true_type)
+  {
+    const format_literal name = enum_name(t);
+    if (name.size() == 0)
+      output_value(s, static_cast<std::underlying_type_t<T>>(t));
+    else if (quote_values(f))
+      output_quoted(s, name.data(), name.size(), f);
+    else
+      emit(s, name);
+  }
+#endif
+
+  template <typename S, typename T, typename F>
+  inline void output_enum(S& s, T t, const F&, std::false_type)
+  {
+    output_value(s, static_cast<std::underlying_type_t<T>>(t));
+  }
+} // detail
+
+template <typename T, typename F>
+struct stringifier_select<T, F, detail::is_enum_tag>
+{
+  explicit stringifier_select(T t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+#ifdef PRETTYPRINT_HAS_ENUM_NAMES
+    detail::output_enum(s, m_t, m_f, detail::wants_enum_names<F>{});
+#else
+    detail::output_enum(s, m_t, m_f, std::false_type{});
+#endif
+    return s;
+  }
+
+  T m_t;
+  const F& m_f;
+};
+
+// -----------------------------------------------------------------------------
+// Map keys, for formatters with quote_keys(). A key is output as it is if
+// it's output as a string anyway (characters and text, with quote_values), in
+// quotes if it's a number, bool, enum (unless it's output by name) or nullptr,
+// and as a string of its output if it's anything else (a container, pair,
+// tuple or struct).
+namespace detail
+{
+  struct key_as_is {};
+  struct key_in_quotes {};
+  struct key_as_string {};
+  struct key_enum {};
+
+  template <typename K, typename Tag = stringifier_tag<K>>
+  struct key_kind { using type = key_as_string; };
+  template <typename K>
+  struct key_kind<K, is_outputtable_tag>
+  {
+    using type = std::conditional_t<
+      std::is_arithmetic<K>::value && !is_bulk_char<K>::value,
+      key_in_quotes, key_as_is>;
+  };
+  template <typename K>
+  struct key_kind<K, is_wide_string_tag> { using type = key_as_is; };
+  template <typename K>
+  struct key_kind<K, is_callable_tag> { using type = key_as_is; };
+  template <typename K>
+  struct key_kind<K, is_enum_tag> { using type = key_enum; };
+  template <typename K>
+  struct key_kind<K, is_unprintable_tag>
+  {
+    using type = std::conditional_t<std::is_null_pointer<K>::value,
+                                    key_in_quotes, key_as_is>;
+  };
+
+  template <typename S, typename K, typename F>
+  inline void output_key(S& s, const K& k, const F& f, key_in_quotes)
+  {
+    const char* q = "";
+    emit(s, opener(f, q));
+    output_nested(s, k, f);
+    emit(s, closer(f, q));
+  }
+
+  template <typename S, typename K, typename F>
+  inline void output_key(S& s, const K& k, const F& f, key_as_is)
+  {
+    if (quote_values(f))
+      output_nested(s, k, f);
+    else
+      output_key(s, k, f, key_in_quotes{});
+  }
+
+  // An enum with a name is output as a string (by quote_values) already.
+  template <typename E>
+  inline bool is_named(E, std::false_type) { return false; }
+
+#ifdef PRETTYPRINT_HAS_ENUM_NAMES
+  template <typename E>
+  inline bool is_named(E e, std::true_type) { return enum_name(e).size() != 0; }
+#endif
+
+  template <typename S, typename K, typename F>
+  inline void output_key(S& s, const K& k, const F& f, key_enum)
+  {
+#ifdef PRETTYPRINT_HAS_ENUM_NAMES
+    if (quote_values(f) && is_named(k, wants_enum_names<F>{}))
+    {
+      output_nested(s, k, f);
+      return;
+    }
+#endif
+    output_key(s, k, f, key_in_quotes{});
+  }
+
+  template <typename S, typename K, typename F>
+  inline void output_key(S& s, const K& k, const F& f, key_as_string)
+  {
+    string_sink<scratch_allocator<char>> b;
+    prettyprint_to(b, k, f);
+    output_quoted(s, b.data(), b.size(), f);
+  }
+
+  template <typename S, typename K, typename F>
+  inline void output_key(S& s, const K& k, const F& f)
+  {
+    if (quote_keys(f))
+      output_key(s, k, f, typename key_kind<std::remove_cv_t<K>>::type{});
+    else
+      output_nested(s, k, f);
+  }
+} // detail
+
+// -----------------------------------------------------------------------------
+// Specialization for pair
+template <typename T, typename F>
+struct stringifier_select<T, F, detail::is_pair_tag>
+{
+  explicit stringifier_select(const T& t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    detail::begin_group(s);
+    detail::emit(s, detail::opener(m_f, m_t));
+    detail::line_break(s);
+    detail::output_nested(s, m_t.first, m_f);
+    detail::emit(s, detail::separator(m_f, m_t));
+    detail::line_break(s);
+    detail::output_nested(s, m_t.second, m_f);
+    detail::line_break(s, true);
+    detail::emit(s, detail::closer(m_f, m_t));
+    detail::end_group(s);
+    return s;
+  }
+
+  const T& m_t;
+  const F& m_f;
+};
+
+// -----------------------------------------------------------------------------
+// Specialization for tuple
+namespace detail
+{
+  template <typename F, typename...Ts, std::size_t...Is>
+  inline void for_each_in_tuple(const std::tuple<Ts...>& t, F f,
+                                std::index_sequence<Is...>)
+  {
+    using I = std::initializer_list<int>;
+    (void) I { (f(std::get<Is>(t), Is), 0)... };
+  }
+
+  template <typename F, typename...Ts>
+  inline void for_each_in_tuple(const std::tuple<Ts...>& t, F f)
+  {
+    for_each_in_tuple(t, f, std::make_index_sequence<sizeof...(Ts)>());
+  }
+} // detail
+
+namespace detail
+{
+  // Output t's elements (a tuple, perhaps of references) like a tuple, with
+  // the opener, separator and closer for c.
+  template <typename S, typename C, typename T, typename F>
+  inline S& output_tuple(S& s, const C& c, const T& t, const F& f)
+  {
+    begin_group(s);
+    emit(s, opener(f, c));
+    const auto sep = hoist(separator(f, c));
+    for_each_in_tuple(t,
+                      [&s, &f, &sep] (auto&& e, size_t i)
+                      { if (i > 0) emit(s, sep);
+                        line_break(s);
+                        output_nested(s, std::forward<decltype(e)>(e), f); });
+    if (std::tuple_size<T>::value > 0)
+      line_break(s, true);
+    emit(s, closer(f, c));
+    end_group(s);
+    return s;
+  }
+} // detail
+
+template <typename T, typename F>
+struct stringifier_select<T, F, detail::is_tuple_tag>
+{
+  explicit stringifier_select(const T& t, const F& f)
+    : m_t(t)
+    , m_f(f)
+  {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    return detail::output_tuple(s, m_t, m_t, m_f);
+  }
+
+  const T& m_t;
+  const F& m_f;
+};
+
+// -----------------------------------------------------------------------------
+// Specialization for aggregates: the fields are bound, tied into a tuple of
+// references and output like a tuple (with the opener and closer for the
+// struct, so {by,default})
+#ifdef PRETTYPRINT_HAS_AGGREGATES
+namespace detail
+{
+#define PRETTYPRINT_FIELDS(n, ...)                                      \
+  template <typename T>                                                 \
+  inline auto tie_fields(const T& t,                                    \
+                         std::integral_constant<std::size_t, n>)        \
+  {                                                                     \
+    const auto& [__VA_ARGS__] = t;                                      \
+    return std::tie(__VA_ARGS__);                                       \
+  }
+
+  PRETTYPRINT_FIELDS(1, f0)
+  PRETTYPRINT_FIELDS(2, f0, f1)
+  PRETTYPRINT_FIELDS(3, f0, f1, f2)
+  PRETTYPRINT_FIELDS(4, f0, f1, f2, f3)
+  PRETTYPRINT_FIELDS(5, f0, f1, f2, f3, f4)
+  PRETTYPRINT_FIELDS(6, f0, f1, f2, f3, f4, f5)
+  PRETTYPRINT_FIELDS(7, f0, f1, f2, f3, f4, f5, f6)
+  PRETTYPRINT_FIELDS(8, f0, f1, f2, f3, f4, f5, f6, f7)
+  PRETTYPRINT_FIELDS(9, f0, f1, f2, f3, f4, f5, f6, f7, f8)
+  PRETTYPRINT_FIELDS(10, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9)
+  PRETTYPRINT_FIELDS(11, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10)
+  PRETTYPRINT_FIELDS(12, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11)
+  PRETTYPRINT_FIELDS(13, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12)
+  PRETTYPRINT_FIELDS(14, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13)
+  PRETTYPRINT_FIELDS(15, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14)
+  PRETTYPRINT_FIELDS(16, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15)
+  PRETTYPRINT_FIELDS(17, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16)
+  PRETTYPRINT_FIELDS(18, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17)
+  PRETTYPRINT_FIELDS(19, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18)
+  PRETTYPRINT_FIELDS(20, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19)
+  PRETTYPRINT_FIELDS(21, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20)
+  PRETTYPRINT_FIELDS(22, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20, f21)
+  PRETTYPRINT_FIELDS(23, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20, f21, f22)
+  PRETTYPRINT_FIELDS(24, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23)
+  PRETTYPRINT_FIELDS(25, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24)
+  PRETTYPRINT_FIELDS(26, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24,
+                     f25)
+  PRETTYPRINT_FIELDS(27, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24,
+                     f25, f26)
+  PRETTYPRINT_FIELDS(28, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24,
+                     f25, f26, f27)
+  PRETTYPRINT_FIELDS(29, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24,
+                     f25, f26, f27, f28)
+  PRETTYPRINT_FIELDS(30, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24,
+                     f25, f26, f27, f28, f29)
+  PRETTYPRINT_FIELDS(31, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24,
+                     f25, f26, f27, f28, f29, f30)
+  PRETTYPRINT_FIELDS(32, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12,
+                     f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23, f24,
+                     f25, f26, f27, f28, f29, f30, f31)
+
+#undef PRETTYPRINT_FIELDS
+
+  template <typename T>
+  inline auto tie_fields(const T& t)
+  {
+    return tie_fields(
+        t, std::integral_constant<std::size_t, field_count<T>::value>{});
+  }
+} // detail
+
+template <typename T, typename F>
+struct stringifier_select<T, F, detail::is_aggregate_tag>
+{
+  explicit stringifier_select(const T& t, const F& f)
+    : m_t(t)
+    , m_f(f)
   {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    return detail::output_tuple(s, m_t, detail::tie_fields(m_t), m_f);
+  }
+
+  const T& m_t;
+  const F& m_f;
 };
+#endif
+
+// -----------------------------------------------------------------------------
+// Binary encoding: a formatter derived from cbor_formatter makes the output
+// CBOR (RFC 8949) instead of text. Integers, floats and doubles, bools and
+// nullptr are encoded as themselves (long doubles, which CBOR can't hold
+// without losing precision, as text), strings as text strings, and containers,
+// pairs and tuples as arrays (maps as maps). Containers are length-prefixed
+// when they have size(), and otherwise indefinite-length. Anything else is
+// encoded as a text string of its pretty-printed form. The formatter's hooks
+// and limits don't apply.
+struct cbor_formatter {};
+
+namespace detail
+{
+  template <typename S>
+  inline void cbor_big_endian(S& s, std::uint64_t v, std::size_t n)
+  {
+    char buf[8];
+    for (std::size_t i = n; i > 0; --i, v >>= 8)
+      buf[i - 1] = static_cast<char>(v & 0xff);
+    s.write(buf, n);
+  }
+
+  template <typename S>
+  inline void cbor_head(S& s, unsigned major, std::uint64_t v)
+  {
+    const auto m = static_cast<char>(major << 5);
+    if (v < 24)
+    {
+      s.put(static_cast<char>(m | static_cast<char>(v)));
+    }
+    else if (v <= 0xff)
+    {
+      s.put(static_cast<char>(m | 24));
+      cbor_big_endian(s, v, 1);
+    }
+    else if (v <= 0xffff)
+    {
+      s.put(static_cast<char>(m | 25));
+      cbor_big_endian(s, v, 2);
+    }
+    else if (v <= 0xffffffff)
+    {
+      s.put(static_cast<char>(m | 26));
+      cbor_big_endian(s, v, 4);
+    }
+    else
+    {
+      s.put(static_cast<char>(m | 27));
+      cbor_big_endian(s, v, 8);
+    }
+  }
+
+  enum cbor_major : unsigned
+  {
+    cbor_unsigned = 0,
+    cbor_negative = 1,
+    cbor_text = 3,
+    cbor_array = 4,
+    cbor_map = 5
+  };
+
+  constexpr char cbor_false = '\xf4';
+  constexpr char cbor_true = '\xf5';
+  constexpr char cbor_null = '\xf6';
+  constexpr char cbor_float32 = '\xfa';
+  constexpr char cbor_float64 = '\xfb';
+  constexpr char cbor_break = '\xff';
+
+  template <typename S>
+  inline void cbor_string(S& s, const char* p, std::size_t n)
+  {
+    cbor_head(s, cbor_text, n);
+    write_ref(s, p, n);
+  }
+
+  template <typename S, typename T>
+  inline void cbor_encode(S& s, T&& t);
+
+  // values that operator<< would output
+  template <typename T>
+  using is_cbor_integer = std::integral_constant<
+    bool, is_formatted_integer<T>::value
+    || std::is_same<T, signed char>::value
+    || std::is_same<T, unsigned char>::value>;
+
+  template <typename S, typename T>
+  inline std::enable_if_t<is_cbor_integer<T>::value && std::is_signed<T>::value>
+  cbor_value(S& s, T t, int)
+  {
+    if (t < 0)
+      cbor_head(s, cbor_negative,
+                static_cast<std::uint64_t>(-(static_cast<std::int64_t>(t) + 1)));
+    else
+      cbor_head(s, cbor_unsigned, static_cast<std::uint64_t>(t));
+  }
+
+  template <typename S, typename T>
+  inline std::enable_if_t<is_cbor_integer<T>::value && !std::is_signed<T>::value>
+  cbor_value(S& s, T t, int)
+  {
+    cbor_head(s, cbor_unsigned, static_cast<std::uint64_t>(t));
+  }
+
+  // doubles that are exactly representable as float are encoded as one (a
+  // finite double outside float's range can't be converted to see)
+  template <typename S, typename T>
+  inline std::enable_if_t<std::is_same<T, float>::value
+                          || std::is_same<T, double>::value>
+  cbor_value(S& s, T t, int)
+  {
+    const double d = static_cast<double>(t);
+    const double float_max =
+      static_cast<double>(std::numeric_limits<float>::max());
+    const bool in_range = std::isinf(d) || !(std::fabs(d) > float_max);
+    const float f = in_range ? static_cast<float>(d) : 0.0f;
+    if (in_range && static_cast<double>(f) == d)
+    {
+      std::uint32_t bits;
+      std::memcpy(&bits, &f, sizeof bits);
+      s.put(cbor_float32);
+      cbor_big_endian(s, bits, 4);
+    }
+    else
+    {
+      std::uint64_t bits;
+      std::memcpy(&bits, &d, sizeof bits);
+      s.put(cbor_float64);
+      cbor_big_endian(s, bits, 8);
+    }
+  }
+
+  // (these are templates so that nothing converts to them)
+  template <typename S, typename T>
+  inline std::enable_if_t<std::is_same<T, bool>::value>
+  cbor_value(S& s, T t, int)
+  {
+    s.put(t ? cbor_true : cbor_false);
+  }
+
+  template <typename S, typename T>
+  inline std::enable_if_t<std::is_same<T, char>::value>
+  cbor_value(S& s, T c, int)
+  {
+    cbor_string(s, &c, 1);
+  }
+
+  template <typename S, typename Tr, typename A>
+  inline void cbor_value(S& s, const std::basic_string<char, Tr, A>& t, int)
+  {
+    cbor_string(s, t.data(), t.size());
+  }
+
+#if defined(PRETTYPRINT_HAS_STRING_VIEW)
+  template <typename S, typename Tr>
+  inline void cbor_value(S& s, std::basic_string_view<char, Tr> t, int)
+  {
+    cbor_string(s, t.data(), t.size());
+  }
+#endif
+
+  template <typename S, typename T>
+  inline std::enable_if_t<std::is_same<std::remove_cv_t<T>, char>::value>
+  cbor_value(S& s, T* t, int)
+  {
+    cbor_string(s, t, std::strlen(t));
+  }
+
+  template <typename S, typename T, std::size_t N>
+  inline std::enable_if_t<!std::is_same<std::remove_cv_t<T>, char>::value>
+  cbor_value(S& s, const T (&t)[N], int)
+  {
+    cbor_head(s, cbor_array, N);
+    for (const auto& e : t)
+      cbor_encode(s, e);
+  }
+
+  // anything else is encoded as text
+  template <typename S, typename T>
+  inline void cbor_value(S& s, const T& t, long)
+  {
+    string_sink<scratch_allocator<char>> b;
+    prettyprint(t).output(b);
+    cbor_string(s, b.data(), b.size());
+  }
+
+  template <typename S, typename T, typename Tag>
+  inline std::enable_if_t<!std::is_same<Tag, is_iterable_tag>::value>
+  cbor_encode(S& s, const T& t, Tag)
+  {
+    cbor_value(s, t, 0L);
+  }
+
+  template <typename S, typename T>
+  inline void cbor_encode(S& s, const T& t, is_outputtable_tag)
+  {
+    cbor_value(s, t, 0);
+  }
+
+  template <typename S, typename T>
+  inline void cbor_encode(S& s, const T& t, is_wide_string_tag)
+  {
+    const auto text = wide_text(t);
+    string_sink<scratch_allocator<char>> b;
+    output_utf8(b, text.first, text.second, false);
+    cbor_string(s, b.data(), b.size());
+  }
+
+  template <typename S, typename T>
+  inline void cbor_encode(S& s, const T& t, is_enum_tag)
+  {
+    cbor_value(s, static_cast<std::underlying_type_t<T>>(t), 0);
+  }
+
+  template <typename S, typename T>
+  inline void cbor_encode(S& s, const T& t, is_unprintable_tag)
+  {
+    if (std::is_null_pointer<T>::value)
+      s.put(cbor_null);
+    else
+      cbor_value(s, t, 0L);
+  }
+
+  template <typename S, typename T>
+  inline std::enable_if_t<has_member_size<T>::value>
+  cbor_container(S& s, const T& t, unsigned major)
+  {
+    cbor_head(s, major, static_cast<std::uint64_t>(t.size()));
+  }
 
-// -----------------------------------------------------------------------------
-// Specialize for const char[] and char[]
-template <size_t N, typename F>
-struct stringifier_select<char[N], F, detail::is_outputtable_tag>
-  : public stringifier_select<char*, F, detail::is_outputtable_tag>
-{
-  using S = char[N];
-  explicit stringifier_select(const S& t, const F& f)
-    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
-  {}
-};
+  template <typename S, typename T>
+  inline std::enable_if_t<!has_member_size<T>::value>
+  cbor_container(S& s, const T&, unsigned major)
+  {
+    s.put(static_cast<char>((major << 5) | 31));
+  }
 
-template <size_t N, typename F>
-struct stringifier_select<const char[N], F, detail::is_outputtable_tag>
-  : public stringifier_select<char*, F, detail::is_outputtable_tag>
-{
-  using S = char[N];
-  explicit stringifier_select(const S& t, const F& f)
-    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
-  {}
-};
+  template <typename S, typename T>
+  inline void cbor_container_end(S& s, const T&)
+  {
+    if (!has_member_size<T>::value)
+      s.put(cbor_break);
+  }
 
-template <typename F>
-struct stringifier_select<char[], F, detail::is_outputtable_tag>
-  : public stringifier_select<char*, F, detail::is_outputtable_tag>
+  template <typename S, typename T>
+  inline void cbor_encode(S& s, T& t, is_iterable_tag)
+  {
+    cbor_container(s, t, cbor_array);
+    auto&& r = iterable_ref(t);
+    for (auto b = std::begin(r), e = std::end(r); b != e; ++b)
+      cbor_encode(s, *b);
+    cbor_container_end(s, t);
+  }
+
+  template <typename S, typename T>
+  inline void cbor_encode(S& s, const T& t, is_map_tag)
+  {
+    cbor_container(s, t, cbor_map);
+    for (const auto& e : t)
+    {
+      cbor_encode(s, e.first);
+      cbor_encode(s, e.second);
+    }
+    cbor_container_end(s, t);
+  }
+
+  template <typename S, typename T>
+  inline void cbor_encode(S& s, const T& t, is_pair_tag)
+  {
+    cbor_head(s, cbor_array, 2);
+    cbor_encode(s, t.first);
+    cbor_encode(s, t.second);
+  }
+
+  template <typename S, typename T>
+  inline void cbor_encode(S& s, const T& t, is_tuple_tag)
+  {
+    cbor_head(s, cbor_array, std::tuple_size<T>::value);
+    for_each_in_tuple(t, [&s] (const auto& e, std::size_t)
+                      { cbor_encode(s, e); });
+  }
+
+#ifdef PRETTYPRINT_HAS_AGGREGATES
+  template <typename S, typename T>
+  inline void cbor_encode(S& s, const T& t, is_aggregate_tag)
+  {
+    cbor_encode(s, tie_fields(t), is_tuple_tag{});
+  }
+#endif
+
+  template <typename S, typename T>
+  inline void cbor_encode(S& s, T&& t)
+  {
+    cbor_encode(
+      s, t, typename iterable_constness<std::remove_reference_t<T>>::type{});
+  }
+} // detail
+
+template <typename T, typename F>
+struct stringifier_select<T, F, detail::is_cbor_tag>
 {
-  explicit stringifier_select(char t[], const F& f)
-    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
+  explicit stringifier_select(T& t, const F&)
+    : m_t(t)
   {}
-};
 
-template <typename F>
-struct stringifier_select<const char[], F, detail::is_outputtable_tag>
-  : public stringifier_select<char*, F, detail::is_outputtable_tag>
-{
-  explicit stringifier_select(const char t[], const F& f)
-    : stringifier_select<char*, F, detail::is_outputtable_tag>(t, f)
+  explicit stringifier_select(T&& t, const F&)
+    : m_t(t)
   {}
+
+  template <typename S>
+  S& output(S& s) const
+  {
+    detail::cbor_encode(s, m_t);
+    return s;
+  }
+
+  T& m_t;
 };
 
 // -----------------------------------------------------------------------------
-// Specialize for arrays
+// Differences between two values of the same type, for logging what changed
+// rather than all of it. The two are walked in lockstep, classified as they
+// are for output, and each difference is output on a line of its own, as
+// where it is and what happened there:
+//
+//   [17]: 3 -> 4           an element of a vector (or array, or any sequence)
+//   [2]: added 5           an element past the end of the old sequence
+//   {"key"}: removed 4     a map entry (with its value), or a set element
+//   {"key"}.1: a -> b      an element of a pair, tuple or struct
+//
+// Keys and values are output with the formatter. Ordered maps and sets are
+// merge-joined by their ordering, so a diff is linear in their size;
+// unordered ones are looked up in each other (a multimap's entries with the
+// same key being matched up by value), and their differences come in hash
+// order. Values that can't be compared with == (and pointers, which may
+// be followed) are compared by their output. Nothing is output for equal
+// values, and nothing is formatted for the paths that have no differences.
+//
+// prettyprint_diff_to(sink, old, new[, formatter]);
+// prettyprint_diff(old, new[, formatter]);  // as a string
 namespace detail
 {
-  template <typename T, typename F>
-  inline std::ostream& output_iterable(std::ostream& s,
-                                       const T& t,
-                                       const F& f)
+  SFINAE_DETECT(key_compare, std::declval<typename T::key_compare*>())
+  SFINAE_DETECT(equality, bool(std::declval<const T&>() == std::declval<const T&>()))
+
+  template <typename T>
+  using is_diffed_by_output = std::integral_constant<
+    bool, !has_equality<T>::value || std::is_pointer<T>::value
+    || is_pointer_like<T>::value>;
+
+  // One step of the path to a difference: an index (in a sequence, or of a
+  // pair, tuple or struct) or a key. Steps live on the stack as the values
+  // are walked, and are only output when there's a difference below them.
+  template <typename S, typename F>
+  struct diff_step
   {
-    s << f.opener(t);
-    auto b = std::begin(t);
-    auto e = std::end(t);
-    if (b != e)
+    const diff_step* parent;
+    char kind;  // '[' for a sequence, '.' for a tuple, '{' for a key
+    std::size_t index;
+    const void* key;
+    void (*output_key)(S&, const void*, const F&);
+  };
+
+  template <typename S, typename F>
+  struct diff_state
+  {
+    S& s;
+    const F& f;
+    const diff_step<S, F>* at;
+  };
+
+  template <typename S, typename F>
+  class diff_scope
+  {
+  public:
+    diff_scope(diff_state<S, F>& d, char kind, std::size_t index)
+      : m_d(d)
+      , m_step{d.at, kind, index, nullptr, nullptr}
+    {
+      d.at = &m_step;
+    }
+
+    template <typename K>
+    diff_scope(diff_state<S, F>& d, const K& key)
+      : m_d(d)
+      , m_step{d.at, '{', 0, std::addressof(key), &output_key<K>}
     {
-      s << prettyprint(*b);
-      std::for_each(++b, e,
-                    [&s, &t, &f] (auto&& elem)
-                    { s << f.separator(t)
-                        << prettyprint(std::forward<decltype(elem)>(elem)); });
+      d.at = &m_step;
     }
-    return s << f.closer(t);
+
+    diff_scope(const diff_scope&) = delete;
+    diff_scope& operator=(const diff_scope&) = delete;
+    ~diff_scope() { m_d.at = m_step.parent; }
+
+  private:
+    template <typename K>
+    static void output_key(S& s, const void* key, const F& f)
+    {
+      prettyprint_to(s, *static_cast<const K*>(key), f);
+    }
+
+    diff_state<S, F>& m_d;
+    diff_step<S, F> m_step;
+  };
+
+  template <typename S, typename F>
+  inline void output_diff_path(S& s, const diff_step<S, F>* step, const F& f)
+  {
+    if (!step)
+      return;
+    output_diff_path(s, step->parent, f);
+    s.put(step->kind);
+    if (step->kind == '{')
+    {
+      step->output_key(s, step->key, f);
+      s.put('}');
+      return;
+    }
+    output_integer(s, step->index);
+    if (step->kind == '[')
+      s.put(']');
   }
-}
 
-template <typename T, size_t N, typename F>
-struct stringifier_select<T[N], F, detail::is_outputtable_tag>
-{
-  using S = T[N];
-  explicit stringifier_select(const S& t, const F& f)
-    : m_t(t)
-    , m_f(f)
-  {}
+  template <typename S, typename F>
+  inline void begin_diff(diff_state<S, F>& d)
+  {
+    output_diff_path(d.s, d.at, d.f);
+    if (d.at)
+      d.s.write(": ", 2);
+  }
 
-  std::ostream& output(std::ostream& s) const
+  template <typename S, typename F, typename T>
+  inline void diff_changed(diff_state<S, F>& d, const T& a, const T& b)
   {
-    return detail::output_iterable<S, F>(s, m_t, m_f);
+    begin_diff(d);
+    prettyprint_to(d.s, a, d.f);
+    d.s.write(" -> ", 4);
+    prettyprint_to(d.s, b, d.f);
+    d.s.put('\n');
   }
 
-  const S& m_t;
-  const F& m_f;
-};
+  template <typename S, typename F>
+  inline void diff_event(diff_state<S, F>& d, const char* what)
+  {
+    begin_diff(d);
+    d.s.write(what, std::strlen(what));
+    d.s.put('\n');
+  }
 
-template <typename T, typename F>
-struct stringifier_select<T[], F, detail::is_outputtable_tag>
-{
-  explicit stringifier_select(T[], F)
-  {}
+  template <typename S, typename F, typename T>
+  inline void diff_event(diff_state<S, F>& d, const char* what, const T& t)
+  {
+    begin_diff(d);
+    d.s.write(what, std::strlen(what));
+    d.s.put(' ');
+    prettyprint_to(d.s, t, d.f);
+    d.s.put('\n');
+  }
+
+  template <typename S, typename F, typename T>
+  inline void diff_value(diff_state<S, F>& d, const T& a, const T& b);
 
-  std::ostream& output(std::ostream& s) const
+  // Anything that isn't a container, pair, tuple or struct is compared whole.
+  template <typename F, typename T>
+  inline bool diff_equal(const F&, const T& a, const T& b, std::false_type)
   {
-    return s << "<array (unknown bounds)>";
+    return a == b;
   }
-};
 
-// -----------------------------------------------------------------------------
-// Specialize for bool: do boolalpha explicitly so as not to affect stream state
-template <typename F>
-struct stringifier_select<bool, F, detail::is_outputtable_tag>
-{
-  explicit stringifier_select(bool t, F)
-    : m_t(t) {}
+  template <typename F, typename T>
+  inline bool diff_equal(const F& f, const T& a, const T& b, std::true_type)
+  {
+    string_sink<scratch_allocator<char>> x;
+    string_sink<scratch_allocator<char>> y;
+    prettyprint_to(x, a, f);
+    prettyprint_to(y, b, f);
+    return x.str() == y.str();
+  }
 
-  std::ostream& output(std::ostream& s) const
+  template <typename S, typename F, typename T, typename Tag>
+  inline void diff_value(diff_state<S, F>& d, const T& a, const T& b, Tag)
   {
-    return s << (m_t ? "true" : "false");
+    if (!diff_equal(d.f, a, b, is_diffed_by_output<T>{}))
+      diff_changed(d, a, b);
   }
 
-  bool m_t;
-};
+  // Sequences are compared element by element, by position.
+  template <typename S, typename F, typename I, typename E>
+  inline void diff_sequence(diff_state<S, F>& d, I i, E ie, I j, E je)
+  {
+    std::size_t n = 0;
+    for (; i != ie && j != je; ++i, ++j, ++n)
+    {
+      diff_scope<S, F> step(d, '[', n);
+      diff_value(d, *i, *j);
+    }
+    for (; i != ie; ++i, ++n)
+    {
+      diff_scope<S, F> step(d, '[', n);
+      diff_event(d, "removed", *i);
+    }
+    for (; j != je; ++j, ++n)
+    {
+      diff_scope<S, F> step(d, '[', n);
+      diff_event(d, "added", *j);
+    }
+  }
 
-// -----------------------------------------------------------------------------
-// Specialize for iterable, with customization of opener/closer/separator
-template <typename T, typename F>
-struct stringifier_select<T, F, detail::is_iterable_tag>
-{
-  explicit stringifier_select(const T& t, const F& f)
-    : m_t(t)
-    , m_f(f)
-  {}
+  // Ordered sets are merge-joined. (Equal elements of a multiset pair up in
+  // order, so only a difference in their number shows.)
+  template <typename S, typename F, typename T>
+  inline void diff_set(diff_state<S, F>& d, const T& a, const T& b,
+                       std::true_type)
+  {
+    const auto less = a.key_comp();
+    auto i = a.begin();
+    auto j = b.begin();
+    while (i != a.end() && j != b.end())
+    {
+      if (less(*i, *j))
+      {
+        diff_scope<S, F> step(d, *i);
+        diff_event(d, "removed");
+        ++i;
+      }
+      else if (less(*j, *i))
+      {
+        diff_scope<S, F> step(d, *j);
+        diff_event(d, "added");
+        ++j;
+      }
+      else
+      {
+        ++i;
+        ++j;
+      }
+    }
+    for (; i != a.end(); ++i)
+    {
+      diff_scope<S, F> step(d, *i);
+      diff_event(d, "removed");
+    }
+    for (; j != b.end(); ++j)
+    {
+      diff_scope<S, F> step(d, *j);
+      diff_event(d, "added");
+    }
+  }
 
-  std::ostream& output(std::ostream& s) const
+  // Unordered sets are looked up in each other a group of equal elements at
+  // a time (equal elements are adjacent), so that as for ordered ones, only
+  // a difference in the number of equal elements shows.
+  template <typename S, typename F, typename T>
+  inline void diff_set(diff_state<S, F>& d, const T& a, const T& b,
+                       std::false_type)
   {
-    return detail::output_iterable<std::decay_t<T>, F>(s, m_t, m_f);
+    for (auto i = a.begin(); i != a.end(); )
+    {
+      const auto ra = a.equal_range(*i);
+      const auto na = std::distance(ra.first, ra.second);
+      const auto nb = static_cast<decltype(na)>(b.count(*i));
+      diff_scope<S, F> step(d, *i);
+      for (auto n = nb; n < na; ++n)
+        diff_event(d, "removed");
+      for (auto n = na; n < nb; ++n)
+        diff_event(d, "added");
+      i = ra.second;
+    }
+    for (auto j = b.begin(); j != b.end(); )
+    {
+      const auto rb = b.equal_range(*j);
+      if (a.find(*j) == a.end())
+      {
+        diff_scope<S, F> step(d, *j);
+        for (auto k = rb.first; k != rb.second; ++k)
+          diff_event(d, "added");
+      }
+      j = rb.second;
+    }
   }
 
-  const T& m_t;
-  const F& m_f;
-};
+  template <typename S, typename F, typename T>
+  inline void diff_iterable(diff_state<S, F>& d, const T& a, const T& b,
+                            std::false_type)
+  {
+    diff_sequence(d, a.begin(), a.end(), b.begin(), b.end());
+  }
 
-// -----------------------------------------------------------------------------
-// Specialization for callable object
-template <typename T, typename F>
-struct stringifier_select<T, F, detail::is_callable_tag>
-{
-  explicit stringifier_select(T, F) {}
-  std::ostream& output(std::ostream& s) const
+  template <typename S, typename F, typename T>
+  inline void diff_iterable(diff_state<S, F>& d, const T& a, const T& b,
+                            std::true_type)
   {
-    return s << "<callable "
-             << detail::callable_type<T>()
-             << '>';
+    diff_set(d, a, b, has_key_compare<T>{});
   }
-};
 
-// -----------------------------------------------------------------------------
-// Specialization for unprintable object
-template <typename T, typename F>
-struct stringifier_select<T, F, detail::is_unprintable_tag>
-{
-  explicit stringifier_select(T, F) {}
+  template <typename S, typename F, typename T>
+  inline void diff_value(diff_state<S, F>& d, const T& a, const T& b,
+                         is_iterable_tag)
+  {
+    diff_iterable(d, a, b,
+                  std::integral_constant<bool, has_key_compare<T>::value
+                                               || has_hasher<T>::value>{});
+  }
 
-  std::ostream& output(std::ostream& s) const
+  // Maps are joined on their keys, the same way as sets are, and the values
+  // of the keys in both are compared.
+  template <typename S, typename F, typename T>
+  inline void diff_map(diff_state<S, F>& d, const T& a, const T& b,
+                       std::true_type)
   {
-    return s << detail::unprintable_type<T>();
+    const auto less = a.key_comp();
+    auto i = a.begin();
+    auto j = b.begin();
+    while (i != a.end() && j != b.end())
+    {
+      if (less(i->first, j->first))
+      {
+        diff_scope<S, F> step(d, i->first);
+        diff_event(d, "removed", i->second);
+        ++i;
+      }
+      else if (less(j->first, i->first))
+      {
+        diff_scope<S, F> step(d, j->first);
+        diff_event(d, "added", j->second);
+        ++j;
+      }
+      else
+      {
+        diff_scope<S, F> step(d, i->first);
+        diff_value(d, i->second, j->second);
+        ++i;
+        ++j;
+      }
+    }
+    for (; i != a.end(); ++i)
+    {
+      diff_scope<S, F> step(d, i->first);
+      diff_event(d, "removed", i->second);
+    }
+    for (; j != b.end(); ++j)
+    {
+      diff_scope<S, F> step(d, j->first);
+      diff_event(d, "added", j->second);
+    }
   }
-};
 
-// -----------------------------------------------------------------------------
-// Specialization for enum
-template <typename T, typename F>
-struct stringifier_select<T, F, detail::is_enum_tag>
-{
-  explicit stringifier_select(T t, F)
-    : m_t(t)
-  {}
+  // The entries with one key in an unordered map: those with equal values
+  // are matched up whatever their order, and the rest are paired up in order
+  // and compared, any left over being removed or added. (A map that isn't a
+  // multimap has at most one entry for the key on each side.)
+  template <typename S, typename F, typename I>
+  inline void diff_entries(diff_state<S, F>& d, std::pair<I, I> a,
+                           std::pair<I, I> b)
+  {
+    using V = typename std::iterator_traits<I>::value_type::second_type;
+    std::vector<I, scratch_allocator<I>> added;
+    for (auto j = b.first; j != b.second; ++j)
+      added.push_back(j);
+    std::vector<I, scratch_allocator<I>> removed;
+    for (auto i = a.first; i != a.second; ++i)
+    {
+      const auto j = std::find_if(
+        added.begin(), added.end(), [&] (I e) {
+          return diff_equal(d.f, i->second, e->second,
+                            is_diffed_by_output<V>{}); });
+      if (j == added.end())
+        removed.push_back(i);
+      else
+        added.erase(j);
+    }
+    const std::size_t n = std::min(removed.size(), added.size());
+    for (std::size_t k = 0; k < n; ++k)
+      diff_value(d, removed[k]->second, added[k]->second);
+    for (std::size_t k = n; k < removed.size(); ++k)
+      diff_event(d, "removed", removed[k]->second);
+    for (std::size_t k = n; k < added.size(); ++k)
+      diff_event(d, "added", added[k]->second);
+  }
 
-  std::ostream& output(std::ostream& s) const
+  template <typename S, typename F, typename T>
+  inline void diff_map(diff_state<S, F>& d, const T& a, const T& b,
+                       std::false_type)
   {
-    return s << static_cast<std::underlying_type_t<T>>(m_t);
+    for (auto i = a.begin(); i != a.end(); )
+    {
+      const auto ra = a.equal_range(i->first);
+      diff_scope<S, F> step(d, i->first);
+      diff_entries(d, ra, b.equal_range(i->first));
+      i = ra.second;
+    }
+    for (auto j = b.begin(); j != b.end(); )
+    {
+      const auto rb = b.equal_range(j->first);
+      if (a.find(j->first) == a.end())
+      {
+        diff_scope<S, F> step(d, j->first);
+        for (auto k = rb.first; k != rb.second; ++k)
+          diff_event(d, "added", k->second);
+      }
+      j = rb.second;
+    }
   }
 
-  T m_t;
-};
+  template <typename S, typename F, typename T>
+  inline void diff_value(diff_state<S, F>& d, const T& a, const T& b,
+                         is_map_tag)
+  {
+    diff_map(d, a, b, has_key_compare<T>{});
+  }
 
-// -----------------------------------------------------------------------------
-// Specialization for pair
-template <typename T, typename F>
-struct stringifier_select<T, F, detail::is_pair_tag>
-{
-  explicit stringifier_select(const T& t, const F& f)
-    : m_t(t)
-    , m_f(f)
-  {}
+  // Pairs, tuples and structs are compared element by element.
+  template <std::size_t I, typename S, typename F, typename T>
+  inline void diff_element(diff_state<S, F>& d, const T& a, const T& b)
+  {
+    diff_scope<S, F> step(d, '.', I);
+    diff_value(d, std::get<I>(a), std::get<I>(b));
+  }
 
-  std::ostream& output(std::ostream& s) const
+  template <typename S, typename F, typename T, std::size_t... Is>
+  inline void diff_tuple(diff_state<S, F>& d, const T& a, const T& b,
+                         std::index_sequence<Is...>)
   {
-    return s << m_f.opener(m_t)
-             << prettyprint(m_t.first)
-             << m_f.separator(m_t)
-             << prettyprint(m_t.second)
-             << m_f.closer(m_t);
+    (void) std::initializer_list<int>{(diff_element<Is>(d, a, b), 0)...};
   }
 
-  const T& m_t;
-  const F& m_f;
-};
+  template <typename S, typename F, typename T>
+  inline void diff_value(diff_state<S, F>& d, const T& a, const T& b,
+                         is_pair_tag)
+  {
+    diff_tuple(d, a, b, std::make_index_sequence<2>{});
+  }
 
-// -----------------------------------------------------------------------------
-// Specialization for tuple
-namespace detail
-{
-  template <typename F, typename...Ts, std::size_t...Is>
-  inline void for_each_in_tuple(const std::tuple<Ts...>& t, F f,
-                                std::index_sequence<Is...>)
+  template <typename S, typename F, typename T>
+  inline void diff_value(diff_state<S, F>& d, const T& a, const T& b,
+                         is_tuple_tag)
   {
-    using I = std::initializer_list<int>;
-    (void) I { (f(std::get<Is>(t), Is), 0)... };
+    diff_tuple(d, a, b, std::make_index_sequence<std::tuple_size<T>::value>{});
   }
 
-  template <typename F, typename...Ts>
-  inline void for_each_in_tuple(const std::tuple<Ts...>& t, F f)
+#if defined(PRETTYPRINT_HAS_AGGREGATES)
+  template <typename S, typename F, typename T>
+  inline void diff_value(diff_state<S, F>& d, const T& a, const T& b,
+                         is_aggregate_tag)
   {
-    for_each_in_tuple(t, f, std::make_index_sequence<sizeof...(Ts)>());
+    const auto ta = tie_fields(a);
+    const auto tb = tie_fields(b);
+    diff_tuple(d, ta, tb,
+               std::make_index_sequence<std::tuple_size<decltype(ta)>::value>{});
   }
-} // detail
+#endif
 
-template <typename T, typename F>
-struct stringifier_select<T, F, detail::is_tuple_tag>
-{
-  explicit stringifier_select(const T& t, const F& f)
-    : m_t(t)
-    , m_f(f)
-  {}
+  template <typename S, typename F, typename T>
+  inline void diff_value(diff_state<S, F>& d, const T& a, const T& b)
+  {
+    diff_value(d, a, b, stringifier_tag<std::remove_cv_t<T>>{});
+  }
 
-  std::ostream& output(std::ostream& s) const
+  // Arrays are sequences, except for character arrays, which are strings.
+  template <typename S, typename F, typename T, std::size_t N>
+  inline void diff_array(diff_state<S, F>& d, const T (&a)[N],
+                         const T (&b)[N], std::false_type)
   {
-    s << m_f.opener(m_t);
-    detail::for_each_in_tuple(m_t,
-                              [&s, this] (auto&& e, size_t i)
-                              { if (i > 0) s << m_f.separator(m_t);
-                                s << prettyprint(std::forward<decltype(e)>(e)); });
-    return s << m_f.closer(m_t);
+    diff_sequence(d, a, a + N, b, b + N);
   }
 
-  const T& m_t;
-  const F& m_f;
-};
+  template <typename S, typename F, typename T, std::size_t N>
+  inline void diff_array(diff_state<S, F>& d, const T (&a)[N],
+                         const T (&b)[N], std::true_type)
+  {
+    if (!diff_equal(d.f, a, b, std::true_type{}))
+      diff_changed(d, a, b);
+  }
+
+  template <typename S, typename F, typename T, std::size_t N>
+  inline void diff_value(diff_state<S, F>& d, const T (&a)[N], const T (&b)[N])
+  {
+    diff_array(d, a, b,
+               std::integral_constant<bool, std::is_same<T, char>::value
+                                            || is_wide_char<T>::value>{});
+  }
+} // detail
+
+template <typename S, typename T, typename F>
+inline S& prettyprint_diff_to(S& s, const T& a, const T& b, const F& f)
+{
+  detail::diff_state<S, F> d{s, f, nullptr};
+  detail::diff_value(d, a, b);
+  return s;
+}
+
+template <typename S, typename T>
+inline S& prettyprint_diff_to(S& s, const T& a, const T& b)
+{
+  return prettyprint_diff_to(s, a, b, detail::default_formatter_instance());
+}
+
+template <typename T, typename F>
+inline std::string prettyprint_diff(const T& a, const T& b, const F& f)
+{
+  detail::scratch_buffer buf;
+  return prettyprint_diff_to(buf.sink(), a, b, f).str();
+}
+
+template <typename T>
+inline std::string prettyprint_diff(const T& a, const T& b)
+{
+  return prettyprint_diff(a, b, detail::default_formatter_instance());
+}
 
 #undef SFINAE_DETECT
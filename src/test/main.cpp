@@ -1,9 +1,29 @@
 #include <array>
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <deque>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<optional>)
+#include <optional>
+#endif
+#endif
+#if __cplusplus > 201703L && defined(__has_include)
+#if __has_include(<ranges>)
+#include <ranges>
+#endif
+#endif
+#include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 using namespace std;
 
@@ -27,6 +47,63 @@ ostream& operator<<(ostream& s, const Baz&)
   return s << "Baz";
 }
 
+// formats to a string while being formatted to a string
+struct Nested
+{
+  vector<int> v;
+};
+
+ostream& operator<<(ostream& s, const Nested& n)
+{
+  return s << "Nested" << prettyprint_to_string(n.v);
+}
+
+// hashable, but with no operator<
+struct Unordered
+{
+  int v;
+  bool operator==(const Unordered& u) const { return v == u.v; }
+};
+
+struct unordered_hash
+{
+  std::size_t operator()(const Unordered& u) const
+  { return static_cast<std::size_t>(u.v); }
+};
+
+ostream& operator<<(ostream& s, const Unordered& u)
+{
+  return s << 'K' << u.v;
+}
+
+// a single-pass range, ended by a sentinel, that can only be iterated when
+// non-const
+struct Countdown
+{
+  int n;
+
+  struct sentinel {};
+  struct iterator
+  {
+    Countdown* c;
+    int operator*() const { return c->n; }
+    iterator& operator++() { --c->n; return *this; }
+    bool operator==(sentinel) const { return c->n == 0; }
+    bool operator!=(sentinel) const { return c->n != 0; }
+  };
+
+  iterator begin() { return {this}; }
+  sentinel end() { return {}; }
+};
+
+// a graph node, output as its children
+struct Node
+{
+  vector<shared_ptr<Node>> kids;
+  vector<shared_ptr<Node>>::const_iterator begin() const { return kids.begin(); }
+  vector<shared_ptr<Node>>::const_iterator end() const { return kids.end(); }
+};
+
 void foobar()
 {
 }
@@ -37,6 +114,38 @@ void foobarbind(int, int)
 
 union U {};
 
+// aggregates: printed field by field (as of C++17), unless they have array
+// fields
+struct Point
+{
+  int x;
+  int y;
+};
+
+struct Reading
+{
+  Point where;
+  double value;
+  string name;
+  vector<int> samples;
+};
+
+struct Named
+{
+  int id;
+  char name[8];
+};
+
+#ifdef __cpp_lib_optional
+// std::optional is constructible from anything, so counting fields converts
+// to every type
+struct Maybe
+{
+  optional<int> o;
+  int x;
+};
+#endif
+
 enum Quux
 {
   FOO,
@@ -44,6 +153,13 @@ enum Quux
   BAZ
 };
 
+template <>
+struct enum_range<Quux>
+{
+  static constexpr int min = 0;
+  static constexpr int max = 2;
+};
+
 enum class Garply
 {
   FOO,
@@ -51,6 +167,19 @@ enum class Garply
   BAZ
 };
 
+enum class Wide : short
+{
+  LOW = -300,
+  HIGH = 1000
+};
+
+template <>
+struct enum_range<Wide>
+{
+  static constexpr int min = -300;
+  static constexpr int max = 1000;
+};
+
 struct deque_formatter : public default_formatter
 {
   // use [] for deques
@@ -63,12 +192,136 @@ struct deque_formatter : public default_formatter
   { return ">"; }
 };
 
+struct semicolon_formatter : public default_formatter
+{
+  // separators needn't be string literals
+  template <typename T>
+  std::string separator(const T&) const
+  { return "; "; }
+};
+
+struct map_formatter : public default_formatter
+{
+  template <typename M>
+  constexpr const char* kv_opener(const M&) const { return ""; }
+
+  template <typename M>
+  constexpr const char* kv_separator(const M&) const { return ":"; }
+
+  template <typename M>
+  constexpr const char* kv_closer(const M&) const { return ""; }
+};
+
+struct escaping_formatter : public default_formatter
+{
+  constexpr bool escape_strings() const { return true; }
+};
+
+struct validating_formatter : public default_formatter
+{
+  constexpr bool validate_utf8() const { return true; }
+};
+
+struct limited_formatter : public default_formatter
+{
+  constexpr std::size_t max_elements() const { return 2; }
+  constexpr std::size_t max_depth() const { return 2; }
+};
+
+struct sorting_formatter : public map_formatter
+{
+  constexpr bool sort_unordered() const { return true; }
+};
+
+struct sorted_limited_formatter : public limited_formatter
+{
+  constexpr bool sort_unordered() const { return true; }
+};
+
+struct parallel_formatter : public default_formatter
+{
+  constexpr std::size_t max_threads() const { return 4; }
+};
+
+struct narrow_formatter : public default_formatter
+{
+  constexpr std::size_t line_width() const { return 10; }
+};
+
+struct following_formatter : public default_formatter
+{
+  constexpr bool follow_pointers() const { return true; }
+};
+
+struct small_formatter : public default_formatter
+{
+  constexpr std::size_t max_bytes() const { return 8; }
+};
+
+struct stats_formatter : public default_formatter
+{
+  explicit stats_formatter(prettyprint_stats* s) : last(s) {}
+  constexpr bool time_stats() const { return true; }
+  void report_stats(const prettyprint_stats& s) const { *last = s; }
+  prettyprint_stats* last;
+};
+
+struct naming_formatter : public default_formatter
+{
+  constexpr bool enum_names() const { return true; }
+};
+
+struct json_naming_formatter : public json_formatter
+{
+  constexpr bool enum_names() const { return true; }
+};
+
+template <byte_format B>
+struct bytes_formatter : public default_formatter
+{
+  constexpr byte_format bytes_as() const { return B; }
+};
+
+struct limited_hex_formatter : public bytes_formatter<byte_format::hex>
+{
+  constexpr std::size_t max_elements() const { return 2; }
+};
+
+// counts the bytes it has handed out
+template <typename T>
+struct counting_allocator
+{
+  using value_type = T;
+
+  explicit counting_allocator(std::size_t* n) : count(n) {}
+  template <typename U>
+  counting_allocator(const counting_allocator<U>& a) : count(a.count) {}
+
+  T* allocate(std::size_t n)
+  {
+    *count += n * sizeof(T);
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T* p, std::size_t n) { std::allocator<T>().deallocate(p, n); }
+
+  template <typename U>
+  bool operator==(const counting_allocator<U>& a) const { return count == a.count; }
+  template <typename U>
+  bool operator!=(const counting_allocator<U>& a) const { return count != a.count; }
+
+  std::size_t* count;
+};
+
 #define TEST(decl, expected, ...)               \
   do {                                          \
     ostringstream oss;                          \
     decl;                                       \
     oss << prettyprint(__VA_ARGS__);            \
     assert(oss.str() == expected);              \
+    assert(prettyprint_to_string(__VA_ARGS__)   \
+           == expected);                        \
+    assert(prettyprint_size(__VA_ARGS__)        \
+           == oss.str().size());                \
   } while (false)
 
 int main(int, char* [])
@@ -103,6 +356,13 @@ int main(int, char* [])
   // deque and custom formatter
   TEST(deque<int> x{1}, "{1}", x);
   TEST(deque<int> x{1}, ">1>", x, deque_formatter());
+  TEST(vector<int> x(3), "[0; 0; 0]", x, semicolon_formatter());
+
+  // custom formatters apply to nested values
+  deque<deque<int>> dd{{1},{2}};
+  TEST(dd, ">>1>,>2>>", dd, deque_formatter());
+  vector<deque<string>> vds{{"a"}};
+  TEST(vds, "[>\"a\">]", vds, deque_formatter());
 
   // bool
   TEST(bool b = true, "true", b);
@@ -111,6 +371,15 @@ int main(int, char* [])
   // enum and enum class
   TEST(, "1", BAR);
   TEST(, "2", Garply::BAZ);
+  TEST(, "BAZ", Garply::BAZ, naming_formatter());
+  TEST(, "BAR", BAR, naming_formatter());
+  TEST(, "7", static_cast<Garply>(7), naming_formatter());
+  TEST(, "[LOW,HIGH,0]", (vector<Wide>{Wide::LOW, Wide::HIGH, Wide{}}),
+       naming_formatter());
+  TEST(, "[\"FOO\",1]", (make_pair(Garply::FOO, 1)), json_naming_formatter());
+  map<Garply, int> mg{{Garply::FOO, 1}, {static_cast<Garply>(7), 2}};
+  TEST(, "{\"FOO\":1,\"7\":2}", mg, json_naming_formatter());
+  TEST(, "{\"0\":1,\"7\":2}", mg, json_formatter());
 
   // nullptr
   TEST(, "<nullptr>", nullptr);
@@ -138,12 +407,79 @@ int main(int, char* [])
 
   // unprintable aggregates
   TEST(, "<class>", Foo());
+#ifdef __cpp_structured_bindings
+  TEST(, "{1,2}", (Point{1, 2}));
+  Reading reading{{1, 2}, 2.5, "x", {3, 4}};
+  TEST(, "{{1,2},2.5,\"x\",[3,4]}", reading);
+  TEST(, "[[1,2],2.5,\"x\",[3,4]]", reading, json_formatter());
+  assert(prettyprint_to_string(Point{1, 2}, cbor_formatter()) == "\x82\x01\x02");
+  TEST(, "<class>", (Named{1, "abc"}));
+#ifdef __cpp_lib_optional
+  TEST(, "{<class>,2}", (Maybe{1, 2}));
+#endif
+#endif
   TEST(, "<union>", U());
 
   // pairs and tuples
   TEST(, "(1,2)", (make_pair(1,2)));
   TEST(, "(\"Hello\",42)", (make_tuple("Hello",42)));
 
+  // single-pass ranges with sentinels
+  assert(prettyprint_to_string(Countdown{3}) == "{3,2,1}");
+  assert(prettyprint_to_string(Countdown{5}, limited_formatter())
+         == "{5,4,...}");
+  assert(prettyprint_to_string(Countdown{0}) == "{}");
+  {
+    // only iterated when it (and its container) are non-const
+    Countdown cd{2};
+    assert(prettyprint_to_string(cd) == "{2,1}");
+    const Countdown ccd{2};
+    assert(prettyprint_to_string(ccd) == "<class>" && ccd.n == 2);
+    vector<Countdown> vcd{{1}, {2}};
+    assert(prettyprint_to_string(vcd) == "[{1},{2,1}]");
+    const vector<Countdown> cvcd{{1}};
+    assert(prettyprint_to_string(cvcd) == "[<class>]");
+  }
+#ifdef __cpp_lib_ranges
+  {
+    vector<int> v{1,2,3,4};
+    auto evens = v | views::filter([] (int i) { return i % 2 == 0; });
+    TEST(, "{2,4}", evens);
+    TEST(, "{1,2,...}", views::iota(1), limited_formatter());
+    istringstream in("7 8 9");
+    assert(prettyprint_to_string(views::istream<int>(in)) == "{7,8,9}");
+  }
+#endif
+
+  // maps
+  map<int, string> m{{1, "one"}, {2, "two"}};
+  TEST(m, "{(1,\"one\"),(2,\"two\")}", m);
+  TEST(m, "{1:\"one\",2:\"two\"}", m, map_formatter());
+  map<int, int> m0;
+  TEST(m0, "{}", m0, map_formatter());
+  map<int, map<int, int>> mm{{1, {{2, 3}}}};
+  TEST(mm, "{1:{2:3}}", mm, map_formatter());
+
+  // unordered containers, sorted
+  unordered_map<int, string> um{{3, "c"}, {1, "a"}, {2, "b"}};
+  TEST(um, "{1:\"a\",2:\"b\",3:\"c\"}", um, sorting_formatter());
+  unordered_set<int> us{5, 9, 1, 7, 3};
+  TEST(us, "{1,3,5,7,9}", us, sorting_formatter());
+  TEST(us, "{1,3,...(+3 more)}", us, sorted_limited_formatter());
+  unordered_set<int> us1{4};
+  TEST(us1, "{4}", us1, sorted_limited_formatter());
+  // keys that can't be sorted are left as they are
+  unordered_set<Unordered, unordered_hash> uk{{1}};
+  TEST(uk, "{K1}", uk, sorting_formatter());
+  unordered_map<Unordered, int, unordered_hash> ukm{{{1}, 2}};
+  TEST(ukm, "{K1:2}", ukm, sorting_formatter());
+  TEST(ukm, "{(K1,2)}", ukm);
+  // entries with equal keys are sorted by value, when it has operator<
+  unordered_multimap<int, int> umsort{{1, 3}, {0, 9}, {1, 1}, {1, 2}};
+  TEST(umsort, "{0:9,1:1,1:2,1:3}", umsort, sorting_formatter());
+  unordered_map<int, vector<Unordered>> umv{{1, {{2}}}};
+  TEST(umv, "{1:[K2]}", umv, sorting_formatter());
+
   // object with operator<<
   TEST(, "Baz", Baz());
 
@@ -154,5 +490,442 @@ int main(int, char* [])
   TEST(, "<callable (function)>", foobar);
   TEST(, "<callable (bind expression)>", std::bind(&foobarbind, 1, placeholders::_1));
 
+  // numbers
+  vector<int> vi{0,-1,42,numeric_limits<int>::min()};
+  TEST(vi, "[0,-1,42,-2147483648]", vi);
+  vector<uint64_t> vu{numeric_limits<uint64_t>::max(),100};
+  TEST(vu, "[18446744073709551615,100]", vu);
+  vector<double> vd{1.5,-0.25,1e100,1.0/3,100};
+  TEST(vd, "[1.5,-0.25,1e+100,0.333333,100]", vd);
+  TEST(long double x = 2.5L, "2.5", x);
+  vector<char> vc{'a','b'};
+  TEST(vc, "[a,b]", vc);
+  {
+    // non-default stream state is respected
+    ostringstream oss;
+    oss << hex << prettyprint(vector<int>{10,255});
+    assert(oss.str() == "[a,ff]");
+  }
+
+  // escaped strings
+  TEST(string x = "a\"b\\c\n\x01", "\"a\\\"b\\\\c\\n\\u0001\"",
+       x, escaping_formatter());
+  TEST(, "\"tab\\there\"", "tab\there", escaping_formatter());
+  {
+    // long enough to take the vectorized path, with escapes in and out of it
+    string x(100, 'x');
+    x[3] = '"';
+    x[40] = '\n';
+    x[99] = '\\';
+    string expected = '"' + x.substr(0, 3) + "\\\"" + x.substr(4, 36) + "\\n"
+      + x.substr(41, 58) + "\\\\\"";
+    assert(prettyprint_to_string(x, escaping_formatter()) == expected);
+  }
+
+  // invalid UTF-8 replaced, each maximal invalid sequence by U+FFFD
+  TEST(string x = "a\xff" "b\xe2\x82" "c\xe2\x82\xac",
+       "\"a\xef\xbf\xbd" "b\xef\xbf\xbd" "c\xe2\x82\xac\"",
+       x, validating_formatter());
+  TEST(string x = "\xed\xa0\x80\xf0\x9f\x98\x80\xc0\xaf",
+       "\"\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xf0\x9f\x98\x80"
+       "\xef\xbf\xbd\xef\xbf\xbd\"",
+       x, validating_formatter());
+  {
+    string x(100, 'x');
+    x[70] = '\x80';
+    assert(prettyprint_to_string(x, validating_formatter())
+           == '"' + x.substr(0, 70) + "\xef\xbf\xbd" + x.substr(71) + '"');
+  }
+
+  // wide strings and characters, as UTF-8
+  TEST(wstring x = L"h\u00e9llo \U0001F600", "\"h\xc3\xa9llo \xf0\x9f\x98\x80\"", x);
+  TEST(u16string x = u"\u20ac\U0001F600", "\"\xe2\x82\xac\xf0\x9f\x98\x80\"", x);
+  TEST(, "\"x\\\"y\"", U"x\"y", escaping_formatter());
+  vector<u32string> vw{U"a", U"bc"};
+  TEST(, "[\"a\",\"bc\"]", vw);
+  TEST(, "z", u'z');
+  TEST(, "[\"p\",1]", make_pair(L"p", 1), json_formatter());
+  {
+    // an unpaired surrogate is U+FFFD
+    u16string x(u"a");
+    x += static_cast<char16_t>(0xd800);
+    x += u"b";
+    TEST(, "\"a\xef\xbf\xbd" "b\"", x);
+    // long enough to take the vectorized path, and to need more than one
+    // buffer
+    u32string y(1000, U'q');
+    y[500] = U'\u00e9';
+    assert(prettyprint_to_string(y) == '"' + string(500, 'q') + "\xc3\xa9"
+           + string(499, 'q') + '"');
+    assert(prettyprint_to_string(u"\u00e9", cbor_formatter()) == "\x62\xc3\xa9");
+  }
+
+  // output limits
+  TEST(vector<int> x(5), "[0,0,...(+3 more)]", x, limited_formatter());
+  TEST(int x[3] = {1}, "[1,0,...(+1 more)]", x, limited_formatter());
+  TEST(vector<int> x(2), "[0,0]", x, limited_formatter());
+  vector<vector<vector<int>>> vvv{{{1}}};
+  TEST(vvv, "[[[...]]]", vvv, limited_formatter());
+  TEST(vector<int> x(10, 123), "[123,123,...(+8 more)]", x, small_formatter());
+
+  // output in parallel chunks is the same as serial output
+  {
+    vector<int> v(100000);
+    for (size_t i = 0; i < v.size(); ++i)
+      v[i] = static_cast<int>(i * 7919 % 100003);
+    assert(prettyprint_to_string(v, parallel_formatter())
+           == prettyprint_to_string(v));
+    vector<vector<string>> vv(10000, vector<string>{"a", "b"});
+    assert(prettyprint_to_string(vv, parallel_formatter())
+           == prettyprint_to_string(vv));
+    // nested large vectors: only the outermost one that is big enough is
+    // split
+    vector<vector<int>> vn(2, vector<int>(10000, 7));
+    assert(prettyprint_to_string(vn, parallel_formatter())
+           == prettyprint_to_string(vn));
+    vector<vector<int>> vnn(10000, vector<int>(3, 8));
+    vnn[5000].assign(10000, 9);
+    assert(prettyprint_to_string(vnn, parallel_formatter())
+           == prettyprint_to_string(vnn));
+    ostringstream oss;
+    oss << hex << prettyprint(v, parallel_formatter());
+    ostringstream expected;
+    expected << hex << prettyprint(v);
+    assert(oss.str() == expected.str());
+  }
+
+#if defined(PRETTYPRINT_HAS_WRITEV)
+  // writing to a file descriptor, with large strings referred to in place
+  {
+    vector<string> v{"short", string(1000, 'x'), "", string(300, 'y')};
+    FILE* f = tmpfile();
+    {
+      writev_sink s(fileno(f));
+      prettyprint_to(s, make_pair(v, 1.5));
+      assert(s.size() == prettyprint_size(make_pair(v, 1.5)));
+      s.flush();
+      assert(s.good());
+    }
+    rewind(f);
+    string contents;
+    for (int c; (c = fgetc(f)) != EOF; )
+      contents += static_cast<char>(c);
+    fclose(f);
+    assert(contents == prettyprint_to_string(make_pair(v, 1.5)));
+  }
+#endif
+
+#if defined(PRETTYPRINT_HAS_MMAP)
+  // writing through a memory map, a page at a time
+  {
+    vector<string> v(100, string(100, 'z'));
+    char path[] = "/tmp/prettyprint_testXXXXXX";
+    const int fd = mkstemp(path);
+    {
+      mmap_sink s(fd, 1);
+      prettyprint_to(s, v);
+      prettyprint_to(s, 42);
+      s.close();
+      assert(s.good());
+    }
+    FILE* f = fdopen(fd, "r");
+    string contents;
+    for (int c; (c = fgetc(f)) != EOF; )
+      contents += static_cast<char>(c);
+    fclose(f);
+    unlink(path);
+    assert(contents == prettyprint_to_string(v) + "42");
+  }
+#endif
+
+  // multi-line layout
+  {
+    vector<vector<int>> vv{{1,2,3},{4,5,6}};
+    TEST(, "[\n  [1,2,3],\n  [4,5,6]\n]", vv, narrow_formatter());
+    TEST(, "[[1],[2]]", (vector<vector<int>>{{1},{2}}), narrow_formatter());
+    TEST(, "(\n  1,\n  [\n    1234,\n    5678\n  ]\n)",
+         make_pair(1, vector<int>{1234, 5678}), narrow_formatter());
+    TEST(, "[]", vector<int>(), narrow_formatter());
+  }
+
+  // following pointers
+  {
+    auto shared = make_shared<Node>();
+    Node dag;
+    dag.kids = {shared, shared};
+    TEST(, "{#1={},#1}", dag, following_formatter());
+    auto cycle = make_shared<Node>();
+    cycle->kids.push_back(cycle);
+    TEST(, "#1={#1}", cycle, following_formatter());
+    cycle->kids.clear();
+    int i = 5;
+    vector<int*> vp{&i, &i, nullptr};
+    TEST(, "[#1=5,#1,<nullptr>]", vp, following_formatter());
+    TEST(unique_ptr<int> x(new int(7)), "#1=7", x, following_formatter());
+#ifdef __cpp_lib_optional
+    TEST(optional<int> x, "<nullptr>", x, following_formatter());
+    TEST(optional<int> x = 3, "3", x, following_formatter());
+#endif
+  }
+
+  // JSON
+  {
+    map<string, vector<int>> mj{{"a\n", {1, 2}}, {"b", {}}};
+    TEST(, "{\"a\\n\":[1,2],\"b\":[]}", mj, json_formatter());
+    map<int, double> md{{1, 1.5}, {2, numeric_limits<double>::infinity()}};
+    TEST(, "{\"1\":1.5,\"2\":null}", md, json_formatter());
+    TEST(, "[1,\"two\",null,true,\"c\",\"Baz\",\"<union>\"]",
+         make_tuple(1, "two", nullptr, true, 'c', Baz(), U()), json_formatter());
+    vector<pair<string, int>> vp{{"k", 1}};
+    TEST(, "[[\"k\",1]]", vp, json_formatter());
+    // keys are always strings: characters aren't quoted twice, and keys that
+    // aren't scalars are output as strings
+    map<unsigned char, int> muc{{65, 1}};
+    TEST(, "{\"A\":1}", muc, json_formatter());
+    map<bool, int> mb{{true, 1}};
+    TEST(, "{\"true\":1}", mb, json_formatter());
+    map<vector<int>, int> mv{{{1, 2}, 3}};
+    TEST(, "{\"[1,2]\":3}", mv, json_formatter());
+    map<pair<string, int>, int> mpk{{{"a", 1}, 2}};
+    TEST(, "{\"[\\\"a\\\",1]\":2}", mpk, json_formatter());
+  }
+
+  // binary encoding
+  {
+    const cbor_formatter cbor;
+    assert(prettyprint_to_string(23, cbor) == "\x17");
+    assert(prettyprint_to_string(-500, cbor) == "\x39\x01\xf3");
+    assert(prettyprint_to_string(1.5, cbor) == string("\xfa\x3f\xc0\x00\x00", 5));
+    // beyond float's range, and a long double (as text)
+    assert(prettyprint_to_string(1e300, cbor)
+           == string("\xfb\x7e\x37\xe4\x3c\x88\x00\x75\x9c", 9));
+    assert(prettyprint_to_string(1.5L, cbor) == "\x63" "1.5");
+    assert(prettyprint_to_string(true, cbor) == "\xf5");
+    assert(prettyprint_to_string(nullptr, cbor) == "\xf6");
+    assert(prettyprint_to_string("abc", cbor) == "\x63" "abc");
+    assert(prettyprint_to_string(Baz(), cbor) == "\x63" "Baz");
+    assert(prettyprint_to_string(BAR, cbor) == "\x01");
+    map<int, string> mc{{1, "a"}};
+    assert(prettyprint_to_string(mc, cbor) == "\xa1\x01\x61" "a");
+    assert(prettyprint_to_string(make_tuple(1, vector<int>{2}), cbor)
+           == "\x82\x01\x81\x02");
+    // without size(), containers are indefinite-length
+    assert(prettyprint_to_string(Countdown{2}, cbor) == "\x9f\x02\x01\xff");
+    assert(prettyprint_size(vector<int>{1, 2}, cbor) == 3);
+  }
+
+  // formatting into a sink
+  {
+    buffer_sink s;
+    prettyprint_to(s, make_pair(vector<int>{1,2}, Baz()));
+    assert(s.str() == "([1,2],Baz)");
+    prettyprint_to(s, deque<int>{1}, deque_formatter());
+    assert(s.str() == "([1,2],Baz)>1>");
+  }
+
+  // formatting to strings
+  Nested n{{1,2}};
+  TEST(n, "Nested[1,2]", n);
+  {
+    string s = prettyprint_to_buffer(vector<int>{1,2,3});
+    assert(s == "[1,2,3]");
+    prettyprint_recycle(std::move(s));
+    assert(prettyprint_to_buffer(Nested{{4}}) == "Nested[4]");
+  }
+
+  // bulk output of integers, chars and bools
+  {
+    vector<int> bi{0, -1, 10, 99, 100, 12345, numeric_limits<int>::min()};
+    TEST(, "[0,-1,10,99,100,12345,-2147483648]", bi);
+    TEST(, "[0,-1,...(+5 more)]", bi, limited_formatter());
+    TEST(, "[0; -1; 10; 99; 100; 12345; -2147483648]", bi, semicolon_formatter());
+    TEST(, "[0,-1,10,99,100,12345,-2147483648]", bi, json_formatter());
+    vector<char> bc{'a', 'b'};
+    TEST(, "[a,b]", bc);
+    TEST(, "[\"a\",\"b\"]", bc, json_formatter());
+    vector<bool> bits(130);
+    bits[0] = bits[64] = bits[129] = true;
+    string expected = "[";
+    for (size_t i = 0; i < bits.size(); ++i)
+      expected += string(i ? "," : "") + (bits[i] ? "true" : "false");
+    expected += "]";
+    assert(prettyprint_to_string(bits) == expected);
+    TEST(, "[true,false,...(+128 more)]", bits, limited_formatter());
+    bool ba[2] = {false, true};
+    TEST(, "[false,true]", ba);
+  }
+
+  // byte dumps
+  {
+    const bytes_formatter<byte_format::hex> hex;
+    const bytes_formatter<byte_format::base64> base64;
+    vector<uint8_t> bytes{0x0a, 0x1b, 0xff};
+    TEST(, "\"0a1bff\"", bytes, hex);
+    TEST(, "\"0a1b\"...(+1 more)", bytes, limited_hex_formatter());
+    TEST(, "\"Chv/\"", bytes, base64);
+    TEST(unsigned char ub[4] = "Man", "\"TWFuAA==\"", ub, base64);
+    array<uint8_t, 2> ab = {{'M', 'a'}};
+    TEST(, "\"TWE=\"", ab, base64);
+    TEST(, "[\n,\x1b,\xff]", bytes);
+#ifdef __cpp_lib_byte
+    array<std::byte, 1> sb = {{std::byte{0xa5}}};
+    TEST(, "\"a5\"", sb, hex);
+#endif
+    vector<uint8_t> all(256);
+    string expected = "\"";
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+      all[i] = static_cast<uint8_t>(i);
+      char buf[3];
+      snprintf(buf, sizeof(buf), "%02x", static_cast<unsigned>(i));
+      expected += buf;
+    }
+    expected += "\"";
+    assert(prettyprint_to_string(all, hex) == expected);
+    TEST(unsigned char hd[18] = "0123456789abcdef",
+         "00000000  30 31 32 33 34 35 36 37  38 39 61 62 63 64 65 66  "
+         "|0123456789abcdef|\n"
+         "00000010  00 00                                             "
+         "|..|",
+         hd, bytes_formatter<byte_format::hexdump>());
+  }
+
+  // instrumentation
+  {
+    prettyprint_stats stats;
+    const stats_formatter sf{&stats};
+    const auto nested = make_pair(vector<int>{1, 2, 3}, make_tuple(4, "five"));
+    const string out = prettyprint_to_string(nested, sf);
+    assert(out == "([1,2,3],(4,\"five\"))");
+    // the vector and the tuple, and the values in them
+    assert(stats.elements == 7);
+    assert(stats.bytes == out.size());
+    assert(stats.max_depth == 1);
+    ostringstream oss;
+    oss << prettyprint(vector<vector<string>>{{"a"}, {}}, sf);
+    assert(stats.elements == 3 && stats.bytes == oss.str().size());
+    assert(stats.max_depth == 2);
+    assert(stats.time(stats_category::iterable).count() > 0);
+    assert(stats.time(stats_category::map).count() == 0);
+  }
+
+  // allocator-aware strings
+  {
+    std::size_t allocated = 0;
+    const counting_allocator<char> alloc(&allocated);
+    const vector<int> v(100, 7);
+    const auto s = prettyprint_to_string(allocator_arg, alloc, v);
+    assert(s.c_str() == prettyprint_to_string(v) && allocated >= s.size());
+    // the output fits in the string itself, so what's allocated is for sorting
+    unordered_map<int, int> ui{{2, 3}, {1, 2}};
+    allocated = 0;
+    const auto sorted =
+      prettyprint_to_string(allocator_arg, alloc, ui, sorting_formatter());
+    assert(sorted.c_str() == string("{1:2,2:3}") && allocated > 0);
+#ifdef PRETTYPRINT_HAS_PMR
+    char arena[1024];
+    std::pmr::monotonic_buffer_resource r(arena, sizeof(arena),
+                                          std::pmr::null_memory_resource());
+    const std::pmr::string ps = prettyprint_to_string(&r, ui, sorting_formatter());
+    assert(ps == "{1:2,2:3}");
+    assert(prettyprint_to_string(&r, 42) == "42");
+#endif
+  }
+
+  // diffs
+  {
+    const vector<int> before{1, 2, 3};
+    const vector<int> after{1, 5, 3, 4};
+    assert(prettyprint_diff(before, after) == "[1]: 2 -> 5\n[3]: added 4\n");
+    assert(prettyprint_diff(after, before) == "[1]: 5 -> 2\n[3]: removed 4\n");
+    assert(prettyprint_diff(before, before).empty());
+    assert(prettyprint_diff(3, 4) == "3 -> 4\n");
+    const map<string, vector<pair<int, char>>> m1{{"k", {{1, 'a'}}}, {"gone", {}}};
+    const map<string, vector<pair<int, char>>> m2{{"k", {{1, 'b'}}}, {"new", {}}};
+    assert(prettyprint_diff(m1, m2, json_formatter())
+           == "{\"gone\"}: removed []\n"
+              "{\"k\"}[0].1: \"a\" -> \"b\"\n"
+              "{\"new\"}: added []\n");
+    const set<int> s1{1, 2, 3};
+    const set<int> s2{2, 3, 4};
+    assert(prettyprint_diff(s1, s2) == "{1}: removed\n{4}: added\n");
+    const unordered_map<int, int> u1{{1, 1}, {2, 2}};
+    const unordered_map<int, int> u2{{1, 3}, {2, 2}};
+    assert(prettyprint_diff(u1, u2) == "{1}: 1 -> 3\n");
+    // equal elements and entries with the same key are matched up as
+    // multisets, whatever their order
+    const unordered_multiset<int> ums1{1, 1, 2};
+    const unordered_multiset<int> ums2{1, 2, 2};
+    const string dms = prettyprint_diff(ums1, ums2);
+    assert(dms == "{1}: removed\n{2}: added\n"
+           || dms == "{2}: added\n{1}: removed\n");
+    assert(prettyprint_diff(ums1, ums1).empty());
+    const unordered_multimap<int, int> umm1{{1, 1}, {1, 2}};
+    const unordered_multimap<int, int> umm2{{1, 3}, {1, 1}};
+    const unordered_multimap<int, int> umm3{{1, 1}, {1, 2}, {2, 5}};
+    assert(prettyprint_diff(umm1, umm2) == "{1}: 2 -> 3\n");
+    assert(prettyprint_diff(umm1, umm3) == "{2}: added 5\n");
+    assert(prettyprint_diff(umm3, umm1) == "{2}: removed 5\n");
+    const auto t1 = make_tuple(1, string("x"));
+    const auto t2 = make_tuple(1, string("y"));
+    assert(prettyprint_diff(t1, t2) == ".1: \"x\" -> \"y\"\n");
+    // C strings are compared as strings, not pointers
+    char ca[3] = "ab";
+    const char* p1 = ca;
+    const char* p2 = "ab";
+    assert(prettyprint_diff(p1, p2).empty());
+#ifdef PRETTYPRINT_HAS_AGGREGATES
+    const vector<Point> pts1{{1, 2}};
+    const vector<Point> pts2{{1, 3}};
+    assert(prettyprint_diff(pts1, pts2) == "[0].1: 2 -> 3\n");
+#endif
+  }
+
+  // a stream's width pads the whole output
+  {
+    const vector<int> vpad{1, 2, 3};
+    ostringstream oss;
+    oss << setw(10) << prettyprint(vpad) << '|' << left << setw(9)
+        << prettyprint(vpad) << '|' << setw(4) << prettyprint(vpad) << '|';
+    assert(oss.str() == "   [1,2,3]|[1,2,3]  |[1,2,3]|");
+    ostringstream hex_oss;
+    hex_oss << hex << setfill('.') << setw(8) << prettyprint(vector<int>{255});
+    assert(hex_oss.str() == "....[ff]");
+  }
+
+  // deferred formatting
+  {
+    vector<int> v{1, 2, 3};
+    char name[8] = "abc";
+    deferred_output d = prettyprint_deferred(v);
+    deferred_output dn = prettyprint_deferred(name);
+    int ia[2] = {4, 5};
+    deferred_output da = prettyprint_deferred(ia, deque_formatter());
+    v.clear();
+    name[0] = 'x';
+    ia[0] = 0;
+    assert(d.str() == "[1,2,3]");
+    assert(dn.str() == "\"abc\"");
+    assert(da.str() == "[4,5]");
+    wchar_t wname[8] = L"wide";
+    const char16_t* u16 = u"\u00e9t\u00e9";
+    deferred_output dw = prettyprint_deferred(wname);
+    deferred_output dwl = prettyprint_deferred(L"wide");
+    deferred_output du = prettyprint_deferred(u16);
+    wname[0] = L'x';
+    assert(dw.str() == prettyprint_to_string(L"wide"));
+    assert(dwl.str() == prettyprint_to_string(L"wide"));
+    assert(du.str() == prettyprint_to_string(u16));
+    // too big to be held inline
+    deferred_output db = prettyprint_deferred(array<int, 32>{});
+    deferred_output moved = std::move(db);
+    assert(!db && moved.str().size() == 65);
+    ostringstream oss;
+    oss << d << moved.str().substr(0, 3);
+    assert(oss.str() == "[1,2,3][0,");
+    d = std::move(da);
+    assert(d.str() == "[4,5]" && da.str().empty());
+  }
+
   return 0;
 }